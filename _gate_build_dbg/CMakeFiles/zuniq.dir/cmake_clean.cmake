@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/zuniq.dir/main.cpp.o"
+  "CMakeFiles/zuniq.dir/main.cpp.o.d"
+  "zuniq"
+  "zuniq.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/zuniq.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/zuniq_book.dir/book_builder.cpp.o"
+  "CMakeFiles/zuniq_book.dir/book_builder.cpp.o.d"
+  "zuniq_book"
+  "zuniq_book.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/zuniq_book.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
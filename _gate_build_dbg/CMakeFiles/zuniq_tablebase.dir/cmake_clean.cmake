@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/zuniq_tablebase.dir/tablebase_builder.cpp.o"
+  "CMakeFiles/zuniq_tablebase.dir/tablebase_builder.cpp.o.d"
+  "zuniq_tablebase"
+  "zuniq_tablebase.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/zuniq_tablebase.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
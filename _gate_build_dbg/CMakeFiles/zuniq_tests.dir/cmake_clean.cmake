@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/zuniq_tests.dir/tests.cpp.o"
+  "CMakeFiles/zuniq_tests.dir/tests.cpp.o.d"
+  "CMakeFiles/zuniq_tests.dir/tests_runner.cpp.o"
+  "CMakeFiles/zuniq_tests.dir/tests_runner.cpp.o.d"
+  "zuniq_tests"
+  "zuniq_tests.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/zuniq_tests.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,8 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo
+# Build directory: /root/repo/_gate_build_dbg
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(all_tests "zuniq_tests")
+set_tests_properties(all_tests PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;21;add_test;/root/repo/CMakeLists.txt;0;")
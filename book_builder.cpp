@@ -0,0 +1,76 @@
+/**
+ * Builds the opening book read by the engine (see OpeningBook in zuniq.hpp).
+ *
+ * For each color it walks the game tree of the first plies: in positions where that color moves, a long search
+ * picks the book move and only that move is followed; in positions where the opponent moves, every reply is.
+ * Positions are merged by symmetry, so each one is searched once.
+ *
+ * Usage: zuniq_book [file] [plies] [rounds per thread] [threads]
+ *
+ * @author: Flavio Regis de Arruda <xboard>
+ * @copyright: Flavio Regis de Arruda <xboard>
+ */
+#ifndef NDEBUG
+#define NDEBUG
+#endif
+#ifndef QUIET_MODE
+#define QUIET_MODE 1
+#endif
+
+#include "zuniq.hpp"
+
+static vector<OpeningBook::Entry> build_book(Player book_color, uint32_t plies, uint32_t rounds, uint32_t threads) {
+    unique_ptr<TimeStrategy> ts = make_unique<ConstantTimeStrategy>(0);
+    // A seeded search runs a fixed number of rounds, however long they take.
+    MCTSAgent engine(rounds, TEMPERATURE, ts, book_color, threads, DETERMINISTIC_SEED);
+    Context ctx{{CTX_VAR::ROUND, 0}, {CTX_VAR::ELAPSED_TIME_MILLIS, 0}, {CTX_VAR::AVAILABLE_MOVES, TOTAL_MOVES}};
+    vector<OpeningBook::Entry> entries;
+    unordered_set<uint64_t> seen;
+    vector<Board> frontier{Board()};
+    for (uint32_t ply = 0; ply < plies; ply++) {
+        vector<Board> next;
+        for (const Board &board : frontier) {
+            const auto [key, symmetry] = canonical_lines(board.get_drawn_lines());
+            if (board.is_over() || !seen.insert(key).second) continue;
+            if (board.get_turn() != book_color) {
+                for (const Move &move : board.get_available_moves()) {
+                    next.push_back(board);
+                    next.back().apply_move(move);
+                }
+                continue;
+            }
+            ctx[CTX_VAR::ROUND] = static_cast<int32_t>(ply);
+            ctx[CTX_VAR::AVAILABLE_MOVES] = static_cast<int32_t>(board.get_available_moves().size());
+            Timer timer = Timer().start();
+            const Move move = engine.select_move(board, ctx).first;
+            const uint32_t line = SYMMETRY_TABLES.line_map[symmetry][line_index(move)];
+            entries.push_back({key, line, rounds});
+            next.push_back(board);
+            next.back().apply_move(move);
+            cout << (book_color == Player::WHITE ? "white" : "black") << " ply " << ply << " #" << entries.size()
+                 << ": " << IO::format_move(move) << " in " << timer.elapsed_milli() << " ms" << endl;
+        }
+        frontier = std::move(next);
+    }
+    return entries;
+}
+
+int main(int argc, char *argv[]) {
+    const string file = argc > 1 ? argv[1] : OPENING_BOOK_FILE;
+    const uint32_t plies = argc > 2 ? stoul(argv[2]) : BOOK_BUILDER_PLIES;
+    const uint32_t rounds = argc > 3 ? stoul(argv[3]) : BOOK_BUILDER_ROUNDS;
+    const uint32_t threads = argc > 4 ? stoul(argv[4]) : max(1U, thread::hardware_concurrency());
+    if (plies > NUM_RANDOM_MOVE_ROUNDS) {
+        cerr << "The engine only reads the book during the first " << NUM_RANDOM_MOVE_ROUNDS << " plies." << endl;
+        return 1;
+    }
+    vector<OpeningBook::Entry> entries = build_book(Player::WHITE, plies, rounds, threads);
+    const vector<OpeningBook::Entry> black = build_book(Player::BLACK, plies, rounds, threads);
+    entries.insert(entries.end(), black.begin(), black.end());
+    if (!OpeningBook::write(file, entries)) {
+        cerr << "Could not write " << file << endl;
+        return 1;
+    }
+    cout << "Wrote " << entries.size() << " positions to " << file << endl;
+    return 0;
+}
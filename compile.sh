@@ -8,7 +8,7 @@ rm $FILE
 
 if [ -f "$FILE" ]; then
   echo "$FILE generated. Let's compile it"
-  g++-7 -Wall -pipe -O2 -march=native -g --std=c++17 -lm main_submit.cpp
+  g++-7 -Wall -pipe -O2 -march=native -g --std=c++17 -pthread -lm main_submit.cpp
   if [ $? -eq 0 ]; then
     echo "Compilation finished sucessfully."
   else
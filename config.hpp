@@ -17,6 +17,193 @@ static constexpr bool WHITE_USE_WEIGHT_ROLLOUT = false;
 
 static constexpr bool BLACK_USE_WEIGHT_ROLLOUT = false;
 
+// Heavy playouts take a move that wins at once and avoid moves that let the opponent win at once.
+static constexpr bool WHITE_USE_HEAVY_ROLLOUT = false;
+
+static constexpr bool BLACK_USE_HEAVY_ROLLOUT = false;
+
+// Tactical probes (one move applied plus its legal moves each) allowed per heavy playout move.
+static constexpr unsigned int HEAVY_PLAYOUT_PROBES = 16;
+
+// Below this many legal moves every move is probed as a possible last move, not only closing ones.
+static constexpr unsigned int HEAVY_PLAYOUT_ALL_MOVES = 6;
+
 static constexpr int MIN_ROUND_TO_CLAIM_IS_WINNING = 20;
 
+static constexpr bool USE_PONDERING = true;
+
+static constexpr unsigned int MAX_PONDER_ROUNDS = NUM_ROUNDS;
+
+static constexpr unsigned int NUM_SEARCH_THREADS = 1;
+
+// Blends all-moves-as-first (AMAF) statistics from rollouts into UCT; their weight is
+// sqrt(RAVE_EQUIVALENCE / (3 * visits + RAVE_EQUIVALENCE)), so it fades as a child gets its own visits.
+static constexpr bool USE_RAVE = false;
+
+static constexpr double RAVE_EQUIVALENCE = 10.0;
+
+// PUCT child selection: Q + PUCT_EXPLORATION * P * sqrt(N) / (1 + n) with move priors P from a heuristic.
+// Moves are expanded in order of prior, as soon as the next one scores higher than every expanded child.
+static constexpr bool USE_PUCT = false;
+
+static constexpr double PUCT_EXPLORATION = 2.0;
+
+// Value assumed for a move that has no rollouts yet.
+static constexpr double PUCT_FIRST_PLAY_VALUE = 0.5;
+
+// Factors applied to the prior weight of a move that closes a region, that leaves the opponent a region to
+// close, and that leaves the opponent an even number of legal moves.
+static constexpr double PRIOR_CLOSING_WEIGHT = 2.0;
+
+static constexpr double PRIOR_GIVES_CLOSING_WEIGHT = 0.5;
+
+static constexpr double PRIOR_EVEN_PARITY_WEIGHT = 1.5;
+
+// Progressive widening: a node with n rollouts may have at most WIDENING_K * n^WIDENING_ALPHA children,
+// expanded in order of the move priors.
+static constexpr bool USE_PROGRESSIVE_WIDENING = false;
+
+static constexpr double WIDENING_K = 2.0;
+
+static constexpr double WIDENING_ALPHA = 0.5;
+
+// Rollouts stop after this many plies and the position is scored by a static evaluator; 0 plays them out.
+static constexpr unsigned int ROLLOUT_CUTOFF_PLIES = 0;
+
+// A node whose position is unchanged by some reflections or rotations of the board only expands one move
+// per orbit of those symmetries (the empty board has 9 instead of 60).
+static constexpr bool USE_SYMMETRY_PRUNING = true;
+
+// Implicit minimax: every node also keeps a minimax value backed up from the static evaluator at the leaves and
+// from exact results, which is blended into its winning fraction with this weight (0 turns it off).
+static constexpr double IMPLICIT_MINIMAX_WEIGHT = 0.0;
+
+// Rollouts run from each expanded leaf; their results are backed up to the root in a single pass.
+static constexpr unsigned int ROLLOUTS_PER_LEAF = 4;
+
+// Every EARLY_STOP_INTERVAL rounds, a timed search stops when the most visited root move also has the best
+// winning fraction and no other move could catch up with its visits in the remaining rounds.
+static constexpr bool USE_EARLY_STOP = true;
+
+static constexpr unsigned int EARLY_STOP_INTERVAL = 256;
+
+// Adaptive time management: the base budget of a move is the remaining time split over the moves we are
+// expected to play, estimated from the number of available moves.
+static constexpr bool USE_ADAPTIVE_TIME = true;
+
+// The budget grows by this factor when the best root move changed in the second half of the budget, and
+// again when the two best moves are closer than ADAPTIVE_CLOSE_GAP in winning fraction.
+static constexpr double ADAPTIVE_EXTEND_FACTOR = 1.6;
+
+static constexpr double ADAPTIVE_CLOSE_GAP = 0.02;
+
+// The budget shrinks by this factor when the best move has not changed since the first quarter of the
+// budget and leads by more than ADAPTIVE_CLEAR_GAP.
+static constexpr double ADAPTIVE_SHRINK_FACTOR = 0.5;
+
+static constexpr double ADAPTIVE_CLEAR_GAP = 0.10;
+
+// A move never takes more than this share of the remaining time, minus a reserve for I/O.
+static constexpr double ADAPTIVE_MAX_SHARE = 0.35;
+
+static constexpr unsigned int ADAPTIVE_RESERVE_MILLIS = 500;
+
+// Rounds between two measurements of the search's instability.
+static constexpr unsigned int INSTABILITY_INTERVAL = 100;
+
+// Moves given at most this many ms (0: none) search the root with sequential halving instead of UCB: the
+// rollouts expected in the time are split evenly over SEQUENTIAL_HALVING_CANDIDATES sampled root moves, the
+// worse half of which is dropped after each of log2(candidates) phases. Below the root the search is unchanged.
+static constexpr double SEQUENTIAL_HALVING_MAX_MILLIS = 0.0;
+
+static constexpr unsigned int SEQUENTIAL_HALVING_CANDIDATES = 16;
+
+// Rollouts per ms assumed until a search has measured the speed.
+static constexpr double SEQUENTIAL_HALVING_ROLLOUTS_PER_MILLI = 50.0;
+
+// Fixed seed and fixed rollout count (NUM_ROUNDS per thread) so that games can be replayed.
+static constexpr bool DETERMINISTIC_SEARCH = false;
+
+static constexpr unsigned long long DETERMINISTIC_SEED = 20'210'101ULL;
+
+// Rollouts look up legal moves in a lock-free cache of 2^LEGALITY_CACHE_BITS positions shared by all threads,
+// once at least LEGALITY_CACHE_MIN_LINES lines are drawn.
+static constexpr bool USE_LEGALITY_CACHE = true;
+
+static constexpr unsigned int LEGALITY_CACHE_BITS = 16;
+
+static constexpr unsigned int LEGALITY_CACHE_MIN_LINES = 28;
+
 /* END OF CONSTANTS AFFECTING MCTS ALGORITHM */
+
+/* BEGINNING OF CONSTANTS AFFECTING ENDGAME SOLVER */
+
+// Positions with at most this many available moves are handed to the endgame solver.
+static constexpr unsigned int ENDGAME_SOLVER_MAX_MOVES = 26;
+
+// Node budget per move; above it the solver gives up and MCTS plays instead.
+static constexpr unsigned long long ENDGAME_SOLVER_MAX_NODES = 2'000'000ULL;
+
+// The solvers also give up once they have used this share of the move's time, leaving the rest to MCTS.
+static constexpr double ENDGAME_SOLVER_TIME_SHARE = 0.5;
+
+// Transposition table has 2^ENDGAME_TT_BITS entries of 8 bytes.
+static constexpr unsigned int ENDGAME_TT_BITS = 20;
+
+// Positions with at most this many available moves are tried with the region decomposition solver first.
+static constexpr unsigned int REGION_SOLVER_MAX_MOVES = 30;
+
+static constexpr unsigned long long REGION_SOLVER_MAX_NODES = 2'000'000ULL;
+
+// Each of the region solver's two memos is a direct-mapped table of 2^REGION_SOLVER_MEMO_BITS entries of 24 bytes.
+static constexpr unsigned int REGION_SOLVER_MEMO_BITS = 17;
+
+// Late middlegame positions with at most this many available moves are tried with proof-number search...
+static constexpr unsigned int PN_SEARCH_MAX_MOVES = 36;
+
+// ...within this node budget and what is left of ENDGAME_SOLVER_TIME_SHARE, before MCTS plays.
+static constexpr unsigned long long PN_SEARCH_MAX_NODES = 50'000ULL;
+
+// Proof-number search's transposition table has 2^PN_TT_BITS entries of 16 bytes.
+static constexpr unsigned int PN_TT_BITS = 20;
+
+/* END OF CONSTANTS AFFECTING ENDGAME SOLVER */
+
+/* BEGINNING OF CONSTANTS AFFECTING OPENING BOOK */
+
+// Book file written by zuniq_book and read at startup. During the first NUM_RANDOM_MOVE_ROUNDS rounds the engine
+// plays its moves, and random moves out of book.
+static constexpr const char *OPENING_BOOK_FILE = "zuniq.book";
+
+// zuniq_book searches the positions of the first BOOK_BUILDER_PLIES plies for each color...
+static constexpr unsigned int BOOK_BUILDER_PLIES = 4;
+
+// ...with this many rounds per search thread.
+static constexpr unsigned int BOOK_BUILDER_ROUNDS = 200'000;
+
+/* END OF CONSTANTS AFFECTING OPENING BOOK */
+
+/* BEGINNING OF CONSTANTS AFFECTING TABLEBASE */
+
+// Tablebase file written by zuniq_tablebase and read at startup, when present.
+static constexpr const char *TABLEBASE_FILE = "zuniq.tb";
+
+// zuniq_tablebase solves the positions with at most this many legal moves...
+static constexpr unsigned int TABLEBASE_MAX_MOVES = 18;
+
+// ...met in this many random games.
+static constexpr unsigned int TABLEBASE_BUILDER_GAMES = 100'000;
+
+/* END OF CONSTANTS AFFECTING TABLEBASE */
+
+/* BEGINNING OF CONSTANTS AFFECTING NRPA */
+
+// NRPAAgent's search level: level 0 is a single rollout, level n runs NRPA_ITERATIONS searches of level n - 1.
+static constexpr unsigned int NRPA_LEVEL = 3;
+
+static constexpr unsigned int NRPA_ITERATIONS = 100;
+
+// Step size of the policy adaptation toward the best sequence.
+static constexpr double NRPA_ALPHA = 1.0;
+
+/* END OF CONSTANTS AFFECTING NRPA */
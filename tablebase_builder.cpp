@@ -0,0 +1,61 @@
+/**
+ * Builds the endgame tablebase read by the engine (see Tablebase in zuniq.hpp).
+ *
+ * Every position with at most max moves legal moves is far too many to enumerate, so it solves those that come
+ * up in random games instead, once per symmetry class.
+ *
+ * Usage: zuniq_tablebase [file] [max moves] [games] [seed]
+ *
+ * @author: Flavio Regis de Arruda <xboard>
+ * @copyright: Flavio Regis de Arruda <xboard>
+ */
+#ifndef NDEBUG
+#define NDEBUG
+#endif
+#ifndef QUIET_MODE
+#define QUIET_MODE 1
+#endif
+
+#include "zuniq.hpp"
+
+int main(int argc, char *argv[]) {
+    const string file = argc > 1 ? argv[1] : TABLEBASE_FILE;
+    const uint32_t max_moves = argc > 2 ? stoul(argv[2]) : TABLEBASE_MAX_MOVES;
+    const uint32_t games = argc > 3 ? stoul(argv[3]) : TABLEBASE_BUILDER_GAMES;
+    const uint64_t seed = argc > 4 ? stoull(argv[4]) : DETERMINISTIC_SEED;
+
+    Xoshiro256 rng(seed);
+    const LineSampler uniform(1.0, 1.0);
+    EndgameSolver solver;
+    unordered_map<uint64_t, bool> solved;
+    uint64_t gave_up = 0;
+    Timer timer = Timer().start();
+    for (uint32_t game = 0; game < games; game++) {
+        Position position;
+        uint64_t closing;
+        for (uint64_t legal = position.legal_moves(&closing); legal; legal = position.legal_moves(&closing)) {
+            const auto num_legal = static_cast<uint32_t>(__builtin_popcountll(legal));
+            if (num_legal <= max_moves) {
+                const uint64_t key = canonical_lines(position.get_drawn()).first;
+                if (solved.count(key) == 0) {
+                    const optional<pair<uint32_t, bool>> result = solver.solve(position, ENDGAME_SOLVER_MAX_NODES * 100);
+                    if (result.has_value()) solved.emplace(key, result->second);
+                    else
+                        gave_up++;
+                }
+            }
+            position.apply_move(uniform(legal, closing, rng));
+        }
+        if ((game + 1) % 1000 == 0) {
+            cout << game + 1 << " games, " << solved.size() << " positions, " << gave_up << " gave up in "
+                 << timer.elapsed_milli() << " ms" << endl;
+        }
+    }
+    const optional<size_t> written = Tablebase::write(file, vector<pair<uint64_t, bool>>(ALL(solved)), max_moves);
+    if (!written.has_value()) {
+        cerr << "Could not write " << file << endl;
+        return 1;
+    }
+    cout << "Wrote " << *written << " of " << solved.size() << " positions to " << file << endl;
+    return 0;
+}
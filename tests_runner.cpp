@@ -2,4 +2,5 @@
 // Created by regis on 30/09/2020.
 //
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 #include "lib/catch.hpp"
@@ -3,23 +3,41 @@
 
 #include "config.hpp"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <bitset>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <queue>
 #include <random>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 #define MP make_pair
@@ -33,6 +51,9 @@ using Move = pair<uint32_t, uint32_t>;
 enum class CTX_VAR {
     ROUND,
     ELAPSED_TIME_MILLIS,
+    AVAILABLE_MOVES,
+    // Time already spent on the current move by the agents that handed it over, if any.
+    MOVE_ELAPSED_MILLIS,
 };
 
 using Context = unordered_map<CTX_VAR, int32_t>;
@@ -189,6 +210,627 @@ public:
 };
 
 
+/**
+ * Raises a flag once a deadline passes, from a thread of its own, so that a search loop can test for the end of
+ * its time with a single relaxed load instead of reading the clock. The deadline can be moved while it runs.
+ */
+class Deadline {
+
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<bool> expired_{false};
+    Clock::time_point start_time_;
+    Clock::time_point deadline_;
+    bool cancelled_ = false;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread thread_;
+
+    // Capped at a day, which keeps an unbounded limit from overflowing the clock.
+    [[nodiscard]] Clock::time_point after(double millis) const {
+        return start_time_ + std::chrono::microseconds(int64_t(std::clamp(millis, 0.0, 864e5) * 1000.0));
+    }
+
+    void wait() {
+        std::unique_lock lock(mutex_);
+        while (!cancelled_) {
+            if (changed_.wait_until(lock, deadline_) == std::cv_status::timeout && Clock::now() >= deadline_) {
+                expired_.store(true, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+public:
+    explicit Deadline(double millis) : start_time_(Clock::now()) {
+        deadline_ = after(millis);
+        thread_ = std::thread(&Deadline::wait, this);
+    }
+
+    Deadline(const Deadline &rhs) = delete;
+
+    Deadline &operator=(const Deadline &rhs) = delete;
+
+    ~Deadline() { cancel(); }
+
+    [[nodiscard]] bool expired() const noexcept { return expired_.load(std::memory_order_relaxed); }
+
+    // Moves the deadline to `millis` after construction; has no effect once it has expired.
+    void reset(double millis) {
+        {
+            std::lock_guard lock(mutex_);
+            deadline_ = after(millis);
+        }
+        changed_.notify_one();
+    }
+
+    void cancel() {
+        {
+            std::lock_guard lock(mutex_);
+            cancelled_ = true;
+        }
+        changed_.notify_one();
+        if (thread_.joinable()) thread_.join();
+    }
+};
+
+
+/**
+ * xoshiro256** 1.0 by David Blackman and Sebastiano Vigna (https://prng.di.unimi.it/xoshiro256starstar.c).
+ * 32 bytes of state instead of the 2.5 KB of mt19937; jump() advances it by 2^128 draws, which gives
+ * non-overlapping streams for different threads.
+ */
+class Xoshiro256 {
+    uint64_t s_[4];
+
+    static inline uint64_t rotl(const uint64_t x, int k) noexcept {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed = 0) noexcept {
+        // State is filled with splitmix64 as recommended by the authors.
+        for (auto &word : s_) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() noexcept { return 0; }
+
+    static constexpr result_type max() noexcept { return UINT64_MAX; }
+
+    result_type operator()() noexcept {
+        const uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        const uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return result;
+    }
+
+    void jump() noexcept {
+        static constexpr uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                            0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+        uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (uint64_t jump : JUMP) {
+            for (int b = 0; b < 64; b++) {
+                if (jump & (1ULL << b)) {
+                    s0 ^= s_[0];
+                    s1 ^= s_[1];
+                    s2 ^= s_[2];
+                    s3 ^= s_[3];
+                }
+                (*this)();
+            }
+        }
+        s_[0] = s0;
+        s_[1] = s1;
+        s_[2] = s2;
+        s_[3] = s3;
+    }
+
+    bool operator==(const Xoshiro256 &rhs) const noexcept {
+        return equal(begin(s_), end(s_), begin(rhs.s_));
+    }
+};
+
+namespace RNG {
+    struct StreamSource {
+        atomic<uint64_t> master_seed{0x5eed5eed5eed5eedULL};
+        atomic<uint32_t> next_stream{0};
+    };
+
+    StreamSource &source() {
+        static StreamSource src;
+        return src;
+    }
+
+    // The index-th stream of master_seed: the seeded generator jumped index times.
+    Xoshiro256 stream(uint64_t master_seed, uint32_t index) {
+        Xoshiro256 rng(master_seed);
+        for (uint32_t i = 0; i < index; i++) rng.jump();
+        return rng;
+    }
+
+    // Generator of the calling thread. Each thread gets the next unused stream of the master seed.
+    Xoshiro256 &thread_rng() {
+        thread_local Xoshiro256 rng = stream(source().master_seed.load(), source().next_stream++);
+        return rng;
+    }
+
+    // Restarts stream numbering from master_seed. The calling thread takes stream 0.
+    void seed(uint64_t master_seed) {
+        Xoshiro256 &rng = thread_rng();
+        source().master_seed = master_seed;
+        source().next_stream = 1;
+        rng = stream(master_seed, 0);
+    }
+}// namespace RNG
+
+// --------- Line and square numbering -------------------//
+// Horizontal lines (row r in 0..5, col c in 0..4) are numbered r * 5 + c, vertical lines (row r in 0..4, col c
+// in 0..5) are 30 + r * 6 + c and square (r, c) is r * 5 + c.
+static constexpr uint64_t ALL_LINES = (1ULL << TOTAL_MOVES) - 1;
+static constexpr uint32_t ALL_SQUARES = (1U << TOTAL_SQUARES) - 1;
+
+constexpr uint32_t line_index(const Move &m) {
+    uint32_t row = m.first / N, col = m.first % N;
+    if (m.second - m.first == 1) return row * (N - 1) + col;
+    return N * (N - 1) + row * N + col;
+}
+
+constexpr Move line_move(uint32_t line) {
+    if (line < N * (N - 1)) {
+        uint32_t start = (line / (N - 1)) * N + line % (N - 1);
+        return {start, start + 1};
+    }
+    uint32_t start = line - N * (N - 1);
+    return {start, start + N};
+}
+
+struct LineTables {
+    // Squares on both sides of each line (-1 outside of the board).
+    int8_t side_a[TOTAL_MOVES];
+    int8_t side_b[TOTAL_MOVES];
+    // Other lines touching each endpoint of a line.
+    uint64_t touch_a[TOTAL_MOVES];
+    uint64_t touch_b[TOTAL_MOVES];
+    // The four lines around each square.
+    uint64_t square_lines[TOTAL_SQUARES];
+};
+
+constexpr LineTables make_line_tables() {
+    LineTables t{};
+    uint64_t dot_lines[N * N] = {};
+    for (uint32_t r = 0; r < N; r++) {
+        for (uint32_t c = 0; c < N - 1; c++) {
+            uint32_t line = r * (N - 1) + c;
+            t.side_a[line] = static_cast<int8_t>(r > 0 ? (r - 1) * (N - 1) + c : -1);
+            t.side_b[line] = static_cast<int8_t>(r < N - 1 ? r * (N - 1) + c : -1);
+            dot_lines[r * N + c] |= 1ULL << line;
+            dot_lines[r * N + c + 1] |= 1ULL << line;
+        }
+    }
+    for (uint32_t r = 0; r < N - 1; r++) {
+        for (uint32_t c = 0; c < N; c++) {
+            uint32_t line = N * (N - 1) + r * N + c;
+            t.side_a[line] = static_cast<int8_t>(c > 0 ? r * (N - 1) + c - 1 : -1);
+            t.side_b[line] = static_cast<int8_t>(c < N - 1 ? r * (N - 1) + c : -1);
+            dot_lines[r * N + c] |= 1ULL << line;
+            dot_lines[(r + 1) * N + c] |= 1ULL << line;
+        }
+    }
+    for (uint32_t line = 0; line < TOTAL_MOVES; line++) {
+        Move m = line_move(line);
+        t.touch_a[line] = dot_lines[m.first] & ~(1ULL << line);
+        t.touch_b[line] = dot_lines[m.second] & ~(1ULL << line);
+    }
+    for (uint32_t sq = 0; sq < TOTAL_SQUARES; sq++) {
+        uint32_t r = sq / (N - 1), c = sq % (N - 1);
+        t.square_lines[sq] = (1ULL << sq) | (1ULL << (sq + N - 1)) |
+                             (1ULL << (N * (N - 1) + r * N + c)) | (1ULL << (N * (N - 1) + r * N + c + 1));
+    }
+    return t;
+}
+
+static constexpr LineTables LINE_TABLES = make_line_tables();
+
+// --------- Symmetries -------------------//
+// The eight symmetries of the square board. Symmetry s transposes the dots when bit 2 is set, then mirrors the
+// rows when bit 0 is set and the columns when bit 1 is set.
+static constexpr uint32_t NUM_SYMMETRIES = 8;
+
+struct SymmetryTables {
+    // Image of each line under each symmetry.
+    uint8_t line_map[NUM_SYMMETRIES][TOTAL_MOVES];
+    // The symmetry undoing each symmetry.
+    uint8_t inverse[NUM_SYMMETRIES];
+};
+
+constexpr uint32_t symmetric_dot(uint32_t dot, uint32_t s) {
+    uint32_t r = dot / N, c = dot % N;
+    if (s & 4U) {
+        const uint32_t t = r;
+        r = c;
+        c = t;
+    }
+    if (s & 1U) r = N - 1 - r;
+    if (s & 2U) c = N - 1 - c;
+    return r * N + c;
+}
+
+constexpr SymmetryTables make_symmetry_tables() {
+    SymmetryTables t{};
+    for (uint32_t s = 0; s < NUM_SYMMETRIES; s++) {
+        for (uint32_t line = 0; line < TOTAL_MOVES; line++) {
+            const Move m = line_move(line);
+            const uint32_t a = symmetric_dot(m.first, s), b = symmetric_dot(m.second, s);
+            t.line_map[s][line] = static_cast<uint8_t>(line_index(a < b ? Move{a, b} : Move{b, a}));
+        }
+    }
+    for (uint32_t s = 0; s < NUM_SYMMETRIES; s++) {
+        for (uint32_t u = 0; u < NUM_SYMMETRIES; u++) {
+            bool undoes = true;
+            for (uint32_t line = 0; line < TOTAL_MOVES; line++) undoes &= t.line_map[u][t.line_map[s][line]] == line;
+            if (undoes) t.inverse[s] = static_cast<uint8_t>(u);
+        }
+    }
+    return t;
+}
+
+static constexpr SymmetryTables SYMMETRY_TABLES = make_symmetry_tables();
+
+// Image of a set of lines under symmetry s.
+inline uint64_t symmetric_lines(uint64_t lines, uint32_t s) {
+    uint64_t image = 0;
+    for (; lines; lines &= lines - 1) image |= 1ULL << SYMMETRY_TABLES.line_map[s][__builtin_ctzll(lines)];
+    return image;
+}
+
+// True if symmetry s maps the set of lines onto itself; stops at the first line it moves out of the set.
+inline bool is_invariant(uint64_t lines, uint32_t s) {
+    for (uint64_t rest = lines; rest; rest &= rest - 1) {
+        if (((lines >> SYMMETRY_TABLES.line_map[s][__builtin_ctzll(rest)]) & 1ULL) == 0) return false;
+    }
+    return true;
+}
+
+// Smallest image of a set of lines over all symmetries, and the symmetry giving it.
+inline pair<uint64_t, uint32_t> canonical_lines(uint64_t lines) {
+    pair<uint64_t, uint32_t> best{lines, 0};
+    for (uint32_t s = 1; s < NUM_SYMMETRIES; s++) {
+        const uint64_t image = symmetric_lines(lines, s);
+        if (image < best.first) best = {image, s};
+    }
+    return best;
+}
+
+// --------- Position -------------------//
+/**
+ * Bitboard view of a Zuniq position: bit i of a 64 bit mask is line i, bit j of a 32 bit mask is square j.
+ * The drawn lines alone determine a position; closed squares, closed sizes and dead lines are cached.
+ * Copying a Position is copying 24 bytes, so make/unmake is just saving and restoring a copy.
+ */
+struct Position {
+    /**
+     * Which squares are connected through undrawn lines, for a given set of drawn lines.
+     * Bit j of down/up/left/right is set when square j may step in that direction; exit_* are the squares
+     * whose border line on that side is undrawn.
+     */
+    struct Adjacency {
+        uint32_t down, up, left, right;
+        uint32_t exit_top, exit_bottom, exit_left, exit_right;
+
+        explicit Adjacency(uint64_t drawn) {
+            const uint64_t undrawn = ~drawn;
+            const uint32_t inner_h = static_cast<uint32_t>(undrawn >> (N - 1)) & ((1U << ((N - 2) * (N - 1))) - 1);
+            down = inner_h;
+            up = inner_h << (N - 1);
+            exit_top = static_cast<uint32_t>(undrawn) & ((1U << (N - 1)) - 1);
+            exit_bottom = (static_cast<uint32_t>(undrawn >> ((N - 1) * (N - 1))) & ((1U << (N - 1)) - 1)) << ((N - 2) * (N - 1));
+            left = right = exit_left = exit_right = 0;
+            for (uint32_t r = 0; r < N - 1; r++) {
+                const uint32_t v = static_cast<uint32_t>(undrawn >> (N * (N - 1) + r * N)) & ((1U << N) - 1);
+                const uint32_t inner_v = (v >> 1) & ((1U << (N - 2)) - 1);
+                right |= inner_v << (r * (N - 1));
+                left |= inner_v << (r * (N - 1) + 1);
+                exit_left |= (v & 1U) << (r * (N - 1));
+                exit_right |= ((v >> (N - 1)) & 1U) << (r * (N - 1) + N - 2);
+            }
+        }
+
+        [[nodiscard]] uint32_t exits() const { return exit_top | exit_bottom | exit_left | exit_right; }
+
+        // Same adjacency with one more line drawn.
+        [[nodiscard]] Adjacency with_line(uint32_t line) const {
+            Adjacency adj = *this;
+            const int a = LINE_TABLES.side_a[line], b = LINE_TABLES.side_b[line];
+            if (line < N * (N - 1)) {
+                if (a < 0) adj.exit_top &= ~(1U << b);
+                else if (b < 0)
+                    adj.exit_bottom &= ~(1U << a);
+                else {
+                    adj.down &= ~(1U << a);
+                    adj.up &= ~(1U << b);
+                }
+            } else {
+                if (a < 0) adj.exit_left &= ~(1U << b);
+                else if (b < 0)
+                    adj.exit_right &= ~(1U << a);
+                else {
+                    adj.right &= ~(1U << a);
+                    adj.left &= ~(1U << b);
+                }
+            }
+            return adj;
+        }
+
+        // Squares reachable from seed.
+        [[nodiscard]] uint32_t flood(uint32_t seed) const {
+            uint32_t reach = seed;
+            while (true) {
+                uint32_t next = reach | ((reach & down) << (N - 1)) | ((reach & up) >> (N - 1)) |
+                                ((reach & right) << 1) | ((reach & left) >> 1);
+                if (next == reach) return reach;
+                reach = next;
+            }
+        }
+
+        // Squares reachable from seed when they do not reach the border, 0 otherwise.
+        [[nodiscard]] uint32_t enclosed(uint32_t seed) const {
+            const uint32_t border = exits();
+            uint32_t reach = seed;
+            while (!(reach & border)) {
+                uint32_t next = reach | ((reach & down) << (N - 1)) | ((reach & up) >> (N - 1)) |
+                                ((reach & right) << 1) | ((reach & left) >> 1);
+                if (next == reach) return reach;
+                reach = next;
+            }
+            return 0;
+        }
+
+        // Region enclosed on either side of a line that is already drawn in this adjacency.
+        [[nodiscard]] uint32_t enclosed_by_line(uint32_t line) const {
+            const int a = LINE_TABLES.side_a[line], b = LINE_TABLES.side_b[line];
+            if (a >= 0) {
+                uint32_t region = enclosed(1U << a);
+                if (region) return region;
+            }
+            return b >= 0 ? enclosed(1U << b) : 0;
+        }
+    };
+
+    Position() = default;
+
+    // Rebuilds closed regions from the drawn lines.
+    static Position from_drawn(uint64_t drawn) {
+        Position p;
+        p.drawn_ = drawn;
+        Adjacency adj(drawn);
+        p.closed_squares_ = ALL_SQUARES & ~adj.flood(adj.exits());
+        for (uint32_t todo = p.closed_squares_; todo;) {
+            uint32_t region = adj.flood(todo & -todo);
+            p.closed_sizes_ |= 1U << __builtin_popcount(region);
+            todo &= ~region;
+        }
+        p.dead_ = dead_lines(p.closed_squares_);
+        return p;
+    }
+
+    [[nodiscard]] Player get_turn() const noexcept {
+        return (__builtin_popcountll(drawn_) & 1) ? Player::BLACK : Player::WHITE;
+    }
+
+    [[nodiscard]] uint64_t get_drawn() const noexcept { return drawn_; }
+
+    [[nodiscard]] uint32_t get_closed_squares() const noexcept { return closed_squares_; }
+
+    [[nodiscard]] uint32_t get_closed_sizes() const noexcept { return closed_sizes_; }
+
+    [[nodiscard]] uint64_t hash() const noexcept { return hash(drawn_); }
+
+    // Hash of the position with these drawn lines.
+    static uint64_t hash(uint64_t drawn) noexcept {
+        uint64_t z = drawn * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * Squares that drawing line would enclose, or 0 if it closes no region.
+     * Only lines whose two endpoints already touch drawn lines can close a cycle, which skips most floods.
+     */
+    [[nodiscard]] uint32_t enclosed_by(uint32_t line) const {
+        if (!(drawn_ & LINE_TABLES.touch_a[line]) || !(drawn_ & LINE_TABLES.touch_b[line])) return 0;
+        return Adjacency(drawn_).with_line(line).enclosed_by_line(line);
+    }
+
+    // Undrawn lines outside of closed regions, legal or not.
+    [[nodiscard]] uint64_t live_lines() const noexcept {
+        return ALL_LINES & ~drawn_ & ~dead_;
+    }
+
+    /**
+     * Legal lines for the player to move, optionally only among some lines. closing, if given, receives the
+     * live lines that would close a region (legal or not).
+     */
+    [[nodiscard]] uint64_t legal_moves(uint64_t *closing = nullptr, uint64_t among = ALL_LINES) const {
+        const uint64_t candidates = live_lines() & among;
+        uint64_t legal = candidates;
+        uint64_t closing_lines = 0;
+        const Adjacency adj(drawn_);
+        for (uint64_t todo = candidates; todo; todo &= todo - 1) {
+            const uint32_t line = __builtin_ctzll(todo);
+            if (!(drawn_ & LINE_TABLES.touch_a[line]) || !(drawn_ & LINE_TABLES.touch_b[line])) continue;
+            const uint32_t region = adj.with_line(line).enclosed_by_line(line);
+            if (region) {
+                closing_lines |= 1ULL << line;
+                if (closed_sizes_ & (1U << __builtin_popcount(region))) legal &= ~(1ULL << line);
+            }
+        }
+        if (closing != nullptr) *closing = closing_lines;
+        return legal;
+    }
+
+    void apply_move(uint32_t line) {
+        assert(line < TOTAL_MOVES && !(drawn_ & (1ULL << line)) && !(dead_ & (1ULL << line)));
+        const uint32_t region = enclosed_by(line);
+        drawn_ |= 1ULL << line;
+        if (region) {
+            assert(!(closed_sizes_ & (1U << __builtin_popcount(region))));
+            closed_squares_ |= region;
+            closed_sizes_ |= 1U << __builtin_popcount(region);
+            dead_ |= dead_lines(region);
+        }
+    }
+
+private:
+    static uint64_t dead_lines(uint32_t squares) {
+        uint64_t lines = 0;
+        for (; squares; squares &= squares - 1) {
+            lines |= LINE_TABLES.square_lines[__builtin_ctz(squares)];
+        }
+        return lines;
+    }
+
+    uint64_t drawn_ = 0;
+    uint64_t dead_ = 0;
+    uint32_t closed_squares_ = 0;
+    uint32_t closed_sizes_ = 0;
+};
+
+// --------- LegalityCache ---------------//
+/**
+ * Fixed-size, direct-mapped cache of Position::legal_moves() by drawn lines, shared by all search threads
+ * without locks. A slot is three relaxed atomic words and its check word is the drawn lines xor-ed with a mix
+ * of both masks, so that a slot torn by two concurrent writers reads as a miss (lockless hashing as in Crafty).
+ * Only worth it late in the game, where many nodes and rollouts pass through the same few positions.
+ */
+class LegalityCache {
+public:
+    explicit LegalityCache(uint32_t bits) : mask_((1ULL << bits) - 1), slots_(make_unique<Slot[]>(1ULL << bits)) {}
+
+    // The cache used by rollouts and Board::apply_move (see use_legality_cache).
+    static LegalityCache &shared() {
+        static LegalityCache cache(LEGALITY_CACHE_BITS);
+        return cache;
+    }
+
+    /**
+     * Same as position().legal_moves(closing) for the position with these drawn lines, from the cache when it
+     * is there; position() is only called on a miss.
+     */
+    template<class MakePosition>
+    uint64_t legal_moves(uint64_t drawn, uint64_t *closing, MakePosition position) {
+        Slot &slot = slots_[Position::hash(drawn) & mask_];
+        uint64_t legal = slot.legal.load(memory_order_relaxed);
+        uint64_t closing_lines = slot.closing.load(memory_order_relaxed);
+        if ((slot.check.load(memory_order_relaxed) ^ mix(legal, closing_lines)) == drawn) {
+            *closing = closing_lines;
+            return legal;
+        }
+        legal = position().legal_moves(&closing_lines);
+        slot.check.store(drawn ^ mix(legal, closing_lines), memory_order_relaxed);
+        slot.legal.store(legal, memory_order_relaxed);
+        slot.closing.store(closing_lines, memory_order_relaxed);
+        *closing = closing_lines;
+        return legal;
+    }
+
+private:
+    struct Slot {
+        atomic<uint64_t> check{0};
+        atomic<uint64_t> legal{0};
+        atomic<uint64_t> closing{0};
+    };
+
+    // Never 0, so that an empty slot does not match the empty board.
+    static uint64_t mix(uint64_t legal, uint64_t closing) noexcept {
+        return (legal * 0x9e3779b97f4a7c15ULL) ^ (closing * 0xbf58476d1ce4e5b9ULL) ^ 0x94d049bb133111ebULL;
+    }
+
+    uint64_t mask_;
+    unique_ptr<Slot[]> slots_;
+};
+
+// True when a position with these drawn lines is late enough for the LegalityCache to pay off.
+inline bool use_legality_cache(uint64_t drawn) {
+    return USE_LEGALITY_CACHE && __builtin_popcountll(drawn) >= LEGALITY_CACHE_MIN_LINES;
+}
+
+/**
+ * position.legal_moves(closing) for rollouts, through the shared LegalityCache when cached. Rollouts decide
+ * once from their first position: those starting earlier rarely meet the same late positions twice.
+ */
+inline uint64_t rollout_legal_moves(const Position &position, uint64_t *closing, bool cached) {
+    if (cached) {
+        return LegalityCache::shared().legal_moves(position.get_drawn(), closing, [&position]() -> const Position & { return position; });
+    }
+    return position.legal_moves(closing);
+}
+
+// --------- LineSampler ---------------//
+/**
+ * Draws a legal line with a probability proportional to the weight of its class. Lines are classified with
+ * bit operations, then a class is drawn by its total weight and a line of it uniformly: no move list or
+ * distribution is built, and with a fixed number of classes every draw takes constant time.
+ */
+class LineSampler {
+public:
+    enum LineClass { CLOSING, REGULAR, NUM_CLASSES };
+
+    LineSampler(double closing_weight, double regular_weight) : weights_{closing_weight, regular_weight},
+                                                                uniform_(closing_weight == regular_weight) {}
+
+    /**
+     * @param legal : legal lines, not empty.
+     * @param closing : lines that close a region (see Position::legal_moves).
+     */
+    uint32_t operator()(uint64_t legal, uint64_t closing, Xoshiro256 &rng) const noexcept {
+        assert(legal != 0);
+        if (uniform_) return pick(legal, rng());
+        const array<uint64_t, NUM_CLASSES> classes = {legal & closing, legal & ~closing};
+        array<double, NUM_CLASSES> mass;
+        double total = 0.0;
+        for (size_t c = 0; c < NUM_CLASSES; c++) {
+            mass[c] = weights_[c] * __builtin_popcountll(classes[c]);
+            total += mass[c];
+        }
+        // Top 53 bits as a double in [0, total).
+        double u = static_cast<double>(rng() >> 11) * 0x1.0p-53 * total;
+        size_t c = 0;
+        while (c + 1 < NUM_CLASSES && (u >= mass[c] || classes[c] == 0)) {
+            u -= mass[c];
+            c++;
+        }
+        return pick(classes[c], rng());
+    }
+
+private:
+    array<double, NUM_CLASSES> weights_;
+    bool uniform_;
+
+    // Uniform line of lines (not empty) from 64 random bits.
+    static uint32_t pick(uint64_t lines, uint64_t random) noexcept {
+        const auto index = static_cast<uint32_t>(((random >> 32) * __builtin_popcountll(lines)) >> 32);
+#ifdef __BMI2__
+        return __builtin_ctzll(_pdep_u64(1ULL << index, lines));
+#else
+        for (uint32_t i = 0; i < index; i++) lines &= lines - 1;
+        return __builtin_ctzll(lines);
+#endif
+    }
+};
+
 struct Board {
 
     Board() : turn_(Player::WHITE), uf_(N * N) {
@@ -203,6 +845,27 @@ struct Board {
 
     Board &operator=(Board &&rhs) = default;
 
+    // Two boards are the same position when the same lines were drawn.
+    bool operator==(const Board &rhs) const {
+        return drawn_lines_ == rhs.drawn_lines_;
+    }
+
+    bool operator!=(const Board &rhs) const { return !(*this == rhs); }
+
+    // Hash of the drawn lines, independent of the order they were drawn.
+    [[nodiscard]] uint64_t hash() const {
+        return position().hash();
+    }
+
+    // Bitboard copy of this position.
+    [[nodiscard]] Position position() const {
+        return Position::from_drawn(drawn_lines_);
+    }
+
+    [[nodiscard]] uint64_t get_drawn_lines() const noexcept {
+        return drawn_lines_;
+    }
+
     bool is_over() const {
         return available_moves_.empty();
     }
@@ -226,6 +889,12 @@ struct Board {
         return available_moves_.count(m) > 0;
     }
 
+    // Available moves as a bitboard (see line_index), and in closing those of them that close a region.
+    [[nodiscard]] uint64_t available_lines(uint64_t *closing = nullptr) const noexcept {
+        if (closing != nullptr) *closing = closing_lines_;
+        return available_lines_;
+    }
+
     inline bool is_closing_region(const Move &m) const {
         return (uf_.find_set_const(m.first) == uf_.find_set_const(m.second));
     }
@@ -233,6 +902,7 @@ struct Board {
     void apply_move(const Move &m) {
         assert(is_valid(m));
         applied_moves_.insert(m);
+        drawn_lines_ |= 1ULL << line_index(m);
         if (uf_.find_set(m.first) == uf_.find_set(m.second)) {
             const auto &rc = count_regions(m);
             assert(rc.first > 0);
@@ -256,7 +926,11 @@ struct Board {
 
         uf_.union_set(m.first, m.second);
         available_moves_.erase(m);
-        exclude_invalid_next_moves();
+        if (use_legality_cache(drawn_lines_)) {
+            set_moves_from_cache();
+        } else {
+            exclude_invalid_next_moves();
+        }
         change_turn();
     }
 
@@ -370,8 +1044,12 @@ private:
             to_exclude.reserve(available_moves_.size());
         }
         on_hold_moves_.clear();
+        available_lines_ = 0;
+        closing_lines_ = 0;
         for (const auto &move : available_moves_) {
+            available_lines_ |= 1ULL << line_index(move);
             if (uf_.find_set(move.first) == uf_.find_set(move.second)) {
+                closing_lines_ |= 1ULL << line_index(move);
                 applied_moves_.insert(move);
                 auto rc = count_regions(move);
                 applied_moves_.erase(move);
@@ -389,6 +1067,28 @@ private:
         // Excludes then
         for (auto &move : to_exclude) {
             available_moves_.erase(move);
+            available_lines_ &= ~(1ULL << line_index(move));
+        }
+        closing_lines_ &= available_lines_;
+    }
+
+    /**
+     * Same available moves as exclude_invalid_next_moves(), from the LegalityCache's masks. Closing lines that
+     * are illegal now are put on hold, a superset of what exclude_invalid_next_moves() keeps, so they are
+     * checked again after the next move.
+     */
+    void set_moves_from_cache() {
+        uint64_t closing;
+        const uint64_t legal = LegalityCache::shared().legal_moves(drawn_lines_, &closing, [this]() { return position(); });
+        available_moves_.clear();
+        on_hold_moves_.clear();
+        available_lines_ = legal;
+        closing_lines_ = closing & legal;
+        for (uint64_t lines = legal; lines; lines &= lines - 1) {
+            available_moves_.insert(line_move(__builtin_ctzll(lines)));
+        }
+        for (uint64_t lines = closing & ~legal; lines; lines &= lines - 1) {
+            on_hold_moves_.insert(line_move(__builtin_ctzll(lines)));
         }
     }
 
@@ -510,6 +1210,13 @@ private:
     // Executed moves.
     unordered_set<Move, MoveHash> applied_moves_;
     unordered_set<Move, MoveHash> on_hold_moves_;
+
+    // Executed moves as a bitboard (see line_index).
+    uint64_t drawn_lines_ = 0;
+
+    // available_moves_ as a bitboard, and those of them that close a region, kept up to date by apply_move.
+    uint64_t available_lines_ = ALL_LINES;
+    uint64_t closing_lines_ = 0;
 };
 
 namespace IO {
@@ -592,8 +1299,24 @@ protected:
     [[nodiscard]] uint32_t get_total_time_millis() const noexcept { return total_time_millis_; }
 
 public:
+    // How the search of the current move is going, for strategies that adapt to it.
+    struct SearchProgress {
+        double elapsed_millis;
+        // When the best root move last changed.
+        double last_change_millis;
+        // Winning fraction of the best root move minus that of the second best.
+        double top_two_gap;
+    };
+
     explicit TimeStrategy(uint32_t total_time_millis) : total_time_millis_(total_time_millis) {}
     [[nodiscard]] virtual double max_move_time(const Context &) const noexcept = 0;
+
+    // Time limit of the current move given the search progress. Default is max_move_time.
+    [[nodiscard]] virtual double adjust_move_time(const Context &ctx, const SearchProgress &) const noexcept {
+        return max_move_time(ctx);
+    }
+
+    virtual ~TimeStrategy() = default;
 };
 
 class ConstantTimeStrategy : public TimeStrategy {
@@ -637,6 +1360,47 @@ public:
     }
 };
 
+/**
+ * Splits the remaining time over the moves we are expected to play, estimated from the available moves,
+ * then stretches the budget while the search is unstable (the best move changed late, or the two best
+ * moves are close) and cuts it when the choice is clear. A move never takes more than ADAPTIVE_MAX_SHARE
+ * of the remaining time minus a reserve, so the game stays within the total time.
+ */
+class AdaptiveTimeStrategy : public TimeStrategy {
+public:
+    explicit AdaptiveTimeStrategy(uint32_t total_time_millis) : TimeStrategy(total_time_millis) {}
+
+    [[nodiscard]] double max_move_time(const Context &ctx) const noexcept override {
+        assert(ctx.count(CTX_VAR::ELAPSED_TIME_MILLIS) && ctx.count(CTX_VAR::AVAILABLE_MOVES));
+        // Plies left in random play are about 0.4 (late) to 0.66 (start) per available move.
+        const double available = max(1, ctx.at(CTX_VAR::AVAILABLE_MOVES));
+        const double plies_left = available * (0.4 + 0.26 * (available / TOTAL_MOVES) * (available / TOTAL_MOVES));
+        const double own_moves = max(1.0, ceil(plies_left / 2.0));
+        return min(remaining_time(ctx) / own_moves, hard_limit(ctx));
+    }
+
+    [[nodiscard]] double adjust_move_time(const Context &ctx, const SearchProgress &progress) const noexcept override {
+        const double base = max_move_time(ctx);
+        double factor = 1.0;
+        if (progress.last_change_millis > base / 2) factor *= ADAPTIVE_EXTEND_FACTOR;
+        if (progress.top_two_gap < ADAPTIVE_CLOSE_GAP) factor *= ADAPTIVE_EXTEND_FACTOR;
+        if (progress.last_change_millis < base / 4 && progress.top_two_gap > ADAPTIVE_CLEAR_GAP) {
+            factor *= ADAPTIVE_SHRINK_FACTOR;
+        }
+        return min(base * factor, hard_limit(ctx));
+    }
+
+private:
+    [[nodiscard]] double remaining_time(const Context &ctx) const noexcept {
+        const double left = double(get_total_time_millis()) - ctx.at(CTX_VAR::ELAPSED_TIME_MILLIS) - ADAPTIVE_RESERVE_MILLIS;
+        return max(0.0, left);
+    }
+
+    [[nodiscard]] double hard_limit(const Context &ctx) const noexcept {
+        return ADAPTIVE_MAX_SHARE * remaining_time(ctx);
+    }
+};
+
 // --------- Agent -------------------//
 struct Agent {
     explicit Agent(Player color) : color_(color) {}
@@ -645,25 +1409,66 @@ struct Agent {
 
     virtual pair<Move, bool> select_move(const Board &, const Context &) = 0;
 
+    // Keeps thinking on the given position while the opponent is to move. Default is to do nothing.
+    virtual void start_pondering(const Board &, const Context &) {}
+
+    virtual void stop_pondering() {}
+
     virtual ~Agent() = default;
 
 protected:
     Player color_;
 };
 
+// --------- RolloutPolicy -------------------//
+/**
+ * Softmax policy over lines, as adapted by NRPAAgent: a legal line is drawn with probability proportional to
+ * exp(weights[p][line]), where p is the player to move. All weights 0 is the uniform policy.
+ */
+struct RolloutPolicy {
+    array<array<double, TOTAL_MOVES>, 2> weights{};
+
+    // Probability of line among the legal lines (line must be one of them).
+    [[nodiscard]] double probability(Player player, uint64_t legal, uint32_t line) const {
+        const auto &w = weights[static_cast<int>(player)];
+        double total = 0.0;
+        for (uint64_t lines = legal; lines; lines &= lines - 1) total += exp(w[__builtin_ctzll(lines)]);
+        return exp(w[line]) / total;
+    }
+
+    // Draws one of the legal lines (not empty) for player.
+    uint32_t sample(Player player, uint64_t legal, Xoshiro256 &rng) const {
+        assert(legal != 0);
+        const auto &w = weights[static_cast<int>(player)];
+        array<double, TOTAL_MOVES> mass;
+        array<uint32_t, TOTAL_MOVES> lines;
+        uint32_t n = 0;
+        double total = 0.0;
+        for (; legal; legal &= legal - 1) {
+            lines[n] = __builtin_ctzll(legal);
+            total += exp(w[lines[n]]);
+            mass[n++] = total;
+        }
+        // Top 53 bits as a double in [0, total).
+        const double u = static_cast<double>(rng() >> 11) * 0x1.0p-53 * total;
+        return lines[min(n - 1, static_cast<uint32_t>(upper_bound(mass.begin(), mass.begin() + n, u) - mass.begin()))];
+    }
+};
+
 // --------- RandomAgent -------------------//
 struct RandomAgent : public Agent {
-    RandomAgent(Player color, mt19937 rng, bool with_priority = false, bool verbose = false) : Agent(color),
-                                                                                               rng_(rng),
-                                                                                               with_priority_(with_priority),
-                                                                                               verbose_(verbose) {}
+    explicit RandomAgent(Player color, bool with_priority = false, bool verbose = false) : Agent(color),
+                                                                                         with_priority_(with_priority),
+                                                                                         verbose_(verbose) {}
 
     pair<Move, bool> select_move(const Board &b, const Context &) override {
         assert(b.get_turn() == color_);
         Timer timer = Timer().start();
 
         pair<Move, bool> pmove;
-        if (with_priority_) {
+        if (policy_ != nullptr) {
+            pmove = make_pair(line_move(policy_->sample(color_, b.available_lines(), RNG::thread_rng())), false);
+        } else if (with_priority_) {
             pmove = select_move_with_priority(b);
         } else {
             pmove = select_move_no_priority(b);
@@ -680,34 +1485,24 @@ struct RandomAgent : public Agent {
         return pmove;
     }
 
+    // Draws moves from policy (e.g. NRPAAgent::policy()) instead, which must outlive the agent; nullptr stops.
+    void set_policy(const RolloutPolicy *policy) { policy_ = policy; }
+
 private:
-    mt19937 rng_;
     bool with_priority_;
     bool verbose_;
+    const RolloutPolicy *policy_ = nullptr;
 
 
     pair<Move, bool> select_move_with_priority(const Board &board) {
         assert(board.get_turn() == color_);
 
-        vector<Move> moves(ALL(board.get_available_moves()));
-
-        vector<double> prob(moves.size());
-
-        size_t i = 0;
-        for (Move move : moves) {
-            if (board.is_closing_region(move)) {
-                prob[i] = WEIGHT_CLOSE_REGION_MOVE;
-            } else {
-                prob[i] = WEIGHT_REGULAR_MOVE;
-            }
-            ++i;
-        }
-
-        discrete_distribution dist(prob.begin(), prob.end());
+        static const LineSampler sampler(WEIGHT_CLOSE_REGION_MOVE, WEIGHT_REGULAR_MOVE);
 
-        int offset = dist(rng_);
+        uint64_t closing;
+        const uint64_t legal = board.available_lines(&closing);
 
-        return make_pair(moves[offset], false);
+        return make_pair(line_move(sampler(legal, closing, RNG::thread_rng())), false);
     }
 
     pair<Move, bool> select_move_no_priority(const Board &board) {
@@ -717,281 +1512,2276 @@ private:
 
         size_t num_moves = moves.size();
 
-        size_t offset = uniform_int_distribution<size_t>(0, num_moves - 1)(rng_);
+        size_t offset = uniform_int_distribution<size_t>(0, num_moves - 1)(RNG::thread_rng());
 
         return make_pair(*std::next(moves.begin(), offset), false);
     }
 };
 
-// --------- MCTS AGENT ---------------//
-class MCTSAgent : public Agent {
-    uint32_t num_rounds_;
-    double temperature_;
-    unique_ptr<TimeStrategy> ts_;
-    mt19937 &rng_;
-    bool sent_is_winning_;
-    struct ScoredMove;
-    // --------- MCTSNode -------------------//
-    struct MCTSNode {
-
-        MCTSNode(const shared_ptr<Board> &game_state, MCTSNode *parent, std::optional<Move> &&move, mt19937 &rng) : game_state_(game_state), parent_(parent), move_(move), rng_(rng), num_rollouts_(0),
-                                                                                                                    white_win_counts_(0), black_win_count_(0),
-                                                                                                                    unvisited_moves_(ALL(game_state->get_available_moves())) {
-            std::shuffle(ALL(unvisited_moves_), rng_);
-            children_.reserve(unvisited_moves_.size());
-        }
+// --------- HeavyPlayoutAgent -------------------//
+/**
+ * Random player with a tactical filter: it takes a move after which the opponent cannot move, and otherwise
+ * redraws moves after which the opponent could win that way. Both checks apply a move on the bitboard and
+ * count its legal moves; at most HEAVY_PLAYOUT_PROBES of them are done per move, which bounds the cost
+ * relative to a random move.
+ */
+struct HeavyPlayoutAgent : public Agent {
+    explicit HeavyPlayoutAgent(Player color, bool with_priority = false, bool verbose = false) : Agent(color),
+                                                                                               with_priority_(with_priority),
+                                                                                               verbose_(verbose) {}
 
-        MCTSNode(const MCTSNode &rhs) = default;
+    pair<Move, bool> select_move(const Board &b, const Context &) override {
+        assert(b.get_turn() == color_);
+        Timer timer = Timer().start();
+
+        static const LineSampler uniform(1.0, 1.0);
+        static const LineSampler weighted(WEIGHT_CLOSE_REGION_MOVE, WEIGHT_REGULAR_MOVE);
+
+        const Position position = b.position();
+        uint64_t closing;
+        const uint64_t legal = position.legal_moves(&closing);
+        const Move move = line_move(select_line(position, legal, closing, with_priority_ ? weighted : uniform,
+                                                RNG::thread_rng()));
+
+        if (verbose_) {
+            timer.stop();
+#ifndef QUIET_MODE
+            cerr << "[I]: HeavyEngine selected: " << IO::format_move(move) << " in " << timer.elapsed_micro()
+                 << " µs." << endl;
+#endif
+        }
+
+        return make_pair(move, false);
+    }
+
+    /**
+     * Picks a line for the player to move in position.
+     * @param legal, closing : as returned by position.legal_moves(); legal is not empty.
+     * @param sampler : draws the moves that are checked and the fallback move.
+     */
+    static uint32_t select_line(const Position &position, uint64_t legal, uint64_t closing,
+                                const LineSampler &sampler, Xoshiro256 &rng) {
+        assert(legal != 0);
+        uint32_t budget = HEAVY_PLAYOUT_PROBES;
+        // Mostly closing moves leave the opponent without a move; when few moves are left all are tried.
+        for (uint64_t moves = finishing_candidates(legal, closing); moves && budget; moves &= moves - 1) {
+            budget--;
+            Position child = position;
+            child.apply_move(__builtin_ctzll(moves));
+            if (!child.legal_moves()) return __builtin_ctzll(moves);
+        }
+        uint64_t candidates = legal;
+        for (;;) {
+            const uint32_t line = sampler(candidates, closing, rng);
+            if (budget == 0) return line;
+            budget--;
+            Position child = position;
+            child.apply_move(line);
+            if (!opponent_finishes(child, budget)) return line;
+            candidates &= ~(1ULL << line);
+            if (!candidates) return line;
+        }
+    }
+
+private:
+    bool with_priority_;
+    bool verbose_;
+
+    static uint64_t finishing_candidates(uint64_t legal, uint64_t closing) noexcept {
+        return legal & (__builtin_popcountll(legal) <= HEAVY_PLAYOUT_ALL_MOVES ? ALL_LINES : closing);
+    }
+
+    // True if the player to move in position can leave the opponent without a move (as far as budget allows).
+    static bool opponent_finishes(const Position &position, uint32_t &budget) {
+        uint64_t closing;
+        const uint64_t legal = position.legal_moves(&closing);
+        for (uint64_t moves = finishing_candidates(legal, closing); moves && budget; moves &= moves - 1) {
+            budget--;
+            Position child = position;
+            child.apply_move(__builtin_ctzll(moves));
+            if (!child.legal_moves()) return true;
+        }
+        return false;
+    }
+};
+
+// --------- Move priors ---------------//
+/**
+ * Computes an unnormalised prior weight per move (priors[i] for moves[i]) for PUCT selection.
+ * Called once per expanded node, so it should be cheap.
+ */
+using PriorFunction = void (*)(const Position &position, const vector<Move> &moves, vector<float> &priors);
+
+/**
+ * Prefers moves that close a region, that leave the opponent nothing to close and that leave the opponent an
+ * even number of legal moves (a loss for them if no region gets closed anymore).
+ */
+inline void heuristic_prior(const Position &position, const vector<Move> &moves, vector<float> &priors) {
+    uint64_t closing;
+    std::ignore = position.legal_moves(&closing);
+    priors.resize(moves.size());
+    for (size_t i = 0; i < moves.size(); i++) {
+        const uint32_t line = line_index(moves[i]);
+        Position child = position;
+        child.apply_move(line);
+        uint64_t child_closing;
+        const uint64_t child_legal = child.legal_moves(&child_closing);
+        double weight = 1.0;
+        if ((closing >> line) & 1) weight *= PRIOR_CLOSING_WEIGHT;
+        if (child_legal & child_closing) weight *= PRIOR_GIVES_CLOSING_WEIGHT;
+        if (__builtin_popcountll(child_legal) % 2 == 0) weight *= PRIOR_EVEN_PARITY_WEIGHT;
+        priors[i] = static_cast<float>(weight);
+    }
+}
+
+// --------- Static evaluators ---------------//
+/**
+ * Probability that the player to move wins, for rollouts cut off before the end of the game.
+ * @param legal, closing : as returned by position.legal_moves(); legal is not empty.
+ */
+using StaticEvaluator = double (*)(const Position &position, uint64_t legal, uint64_t closing);
+
+/**
+ * Logistic model over move-count parities and the number of closing moves, fitted to the outcomes of uniform
+ * random play (log loss 0.676 against 0.693 for a coin flip).
+ */
+inline double parity_evaluator(const Position &position, uint64_t legal, uint64_t closing) {
+    const int num_legal = __builtin_popcountll(legal);
+    const int num_closing = __builtin_popcountll(legal & closing);
+    const double legal_parity = (num_legal & 1) ? 1.0 : -1.0;
+    const double live_parity = (__builtin_popcountll(position.live_lines()) & 1) ? 1.0 : -1.0;
+    const double z = 0.0108 + 0.2377 * live_parity + 0.1412 * legal_parity +
+                     0.0340 * (num_closing == 0) * legal_parity - 0.1807 * (num_closing == 1) +
+                     (-1.1640 * legal_parity + 3.6733 * (num_closing == 1) - 0.5447 * live_parity) / num_legal;
+    return 1.0 / (1.0 + exp(-z));
+}
+
+// --------- Tablebase ---------------//
+/**
+ * Exact results of endgame positions, built offline by tablebase_builder.cpp and memory-mapped at startup.
+ * Positions are keyed by their canonical lines (see canonical_lines) and indexed with a minimal perfect hash in
+ * the style of BBHash: a cascade of bit arrays where each key owns the bit it alone hashed to in the first level
+ * it did not collide in, and a key's index is the rank of its bit. About 3 bits per position, plus 4 bytes
+ * holding a 31 bit fingerprint, which rejects positions outside the table, and whether the player to move wins.
+ */
+class Tablebase {
+    static constexpr uint64_t MAGIC = 0x31304254514e555aULL;
+    static constexpr uint32_t MAX_LEVELS = 24;
+    // Bits per key in each level: more levels are needed when lower, more space is used when higher.
+    static constexpr double GAMMA = 2.0;
+
+    struct Header {
+        uint64_t magic;
+        uint32_t max_moves;
+        uint32_t num_levels;
+        uint64_t num_keys;
+        uint64_t level_words[MAX_LEVELS];
+    };
+
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t level_hash(uint64_t key, uint32_t level) {
+        return mix(key + 0x9e3779b97f4a7c15ULL * (level + 1));
+    }
+
+    static uint32_t fingerprint(uint64_t key) {
+        return static_cast<uint32_t>(mix(key ^ 0x5851f42d4c957f2dULL) >> 32) & ~1U;
+    }
+
+    const void *data_ = nullptr;
+    size_t data_size_ = 0;
+    const Header *header_ = nullptr;
+    const uint64_t *words_ = nullptr;
+    const uint32_t *ranks_ = nullptr;
+    const uint32_t *values_ = nullptr;
+
+public:
+    Tablebase() = default;
+
+    explicit Tablebase(const string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st {};
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+            void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                data_ = data;
+                data_size_ = st.st_size;
+            }
+        }
+        close(fd);
+        if (data_ == nullptr) return;
+        const auto *header = static_cast<const Header *>(data_);
+        uint64_t num_words = 0;
+        bool empty_level = false;
+        for (uint32_t level = 0; level < min(header->num_levels, MAX_LEVELS); level++) {
+            num_words += header->level_words[level];
+            // probe() takes hashes modulo the level size.
+            empty_level |= header->level_words[level] == 0;
+        }
+        if (header->magic != MAGIC || header->num_levels > MAX_LEVELS || empty_level ||
+            data_size_ != sizeof(Header) + num_words * 12 + header->num_keys * 4) return;
+        header_ = header;
+        words_ = reinterpret_cast<const uint64_t *>(header_ + 1);
+        ranks_ = reinterpret_cast<const uint32_t *>(words_ + num_words);
+        values_ = ranks_ + num_words;
+    }
+
+    Tablebase(const Tablebase &rhs) = delete;
+
+    Tablebase &operator=(const Tablebase &rhs) = delete;
+
+    ~Tablebase() {
+        if (data_ != nullptr) munmap(const_cast<void *>(data_), data_size_);
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return header_ != nullptr ? header_->num_keys : 0; }
+
+    // Positions with at most this many legal moves may be in the table.
+    [[nodiscard]] uint32_t max_moves() const noexcept { return header_ != nullptr ? header_->max_moves : 0; }
+
+    // Whether the player to move wins position, which has num_legal legal moves; nullopt when not in the table.
+    [[nodiscard]] optional<bool> probe(const Position &position, uint32_t num_legal) const {
+        if (header_ == nullptr || num_legal > max_moves()) return nullopt;
+        const uint64_t key = canonical_lines(position.get_drawn()).first;
+        const uint64_t *words = words_;
+        const uint32_t *ranks = ranks_;
+        for (uint32_t level = 0; level < header_->num_levels; level++) {
+            const uint64_t bit = level_hash(key, level) % (header_->level_words[level] * 64);
+            const uint64_t word = words[bit / 64];
+            if ((word >> (bit % 64)) & 1ULL) {
+                const uint32_t value = values_[ranks[bit / 64] + __builtin_popcountll(word & ((1ULL << (bit % 64)) - 1))];
+                if ((value & ~1U) != fingerprint(key)) return nullopt;
+                return (value & 1U) != 0;
+            }
+            words += header_->level_words[level];
+            ranks += header_->level_words[level];
+        }
+        return nullopt;
+    }
+
+    /**
+     * Saves solved positions, given as canonical lines and whether the player to move wins, as a tablebase file.
+     * @return the number of positions written, which misses the few that still collide after MAX_LEVELS levels.
+     */
+    static optional<size_t> write(const string &path, vector<pair<uint64_t, bool>> entries, uint32_t max_moves) {
+        // A repeated key would collide with itself at every level.
+        sort(entries.begin(), entries.end());
+        entries.erase(unique(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.first == b.first; }),
+                      entries.end());
+        Header header{};
+        header.magic = MAGIC;
+        header.max_moves = max_moves;
+        vector<uint64_t> keys;
+        keys.reserve(entries.size());
+        for (const auto &entry : entries) keys.push_back(entry.first);
+        vector<uint64_t> words;
+        while (!keys.empty() && header.num_levels < MAX_LEVELS) {
+            const uint32_t level = header.num_levels++;
+            const auto num_words = static_cast<uint64_t>(ceil(keys.size() * GAMMA / 64.0));
+            vector<uint64_t> taken(num_words, 0), collided(num_words, 0);
+            for (uint64_t key : keys) {
+                const uint64_t bit = level_hash(key, level) % (num_words * 64);
+                if (taken[bit / 64] & (1ULL << (bit % 64))) collided[bit / 64] |= 1ULL << (bit % 64);
+                taken[bit / 64] |= 1ULL << (bit % 64);
+            }
+            vector<uint64_t> next;
+            for (uint64_t key : keys) {
+                const uint64_t bit = level_hash(key, level) % (num_words * 64);
+                if (collided[bit / 64] & (1ULL << (bit % 64))) next.push_back(key);
+            }
+            for (uint64_t w = 0; w < num_words; w++) words.push_back(taken[w] & ~collided[w]);
+            header.level_words[level] = num_words;
+            keys = std::move(next);
+        }
+        vector<uint32_t> ranks(words.size());
+        for (size_t w = 0; w < words.size(); w++) {
+            ranks[w] = static_cast<uint32_t>(header.num_keys);
+            header.num_keys += __builtin_popcountll(words[w]);
+        }
+        vector<uint32_t> values(header.num_keys);
+        for (const auto &[key, win] : entries) {
+            uint64_t offset = 0;
+            for (uint32_t level = 0; level < header.num_levels; level++) {
+                const uint64_t bit = level_hash(key, level) % (header.level_words[level] * 64);
+                const uint64_t word = words[offset + bit / 64];
+                if ((word >> (bit % 64)) & 1ULL) {
+                    values[ranks[offset + bit / 64] + __builtin_popcountll(word & ((1ULL << (bit % 64)) - 1))] =
+                            fingerprint(key) | (win ? 1U : 0U);
+                    break;
+                }
+                offset += header.level_words[level];
+            }
+        }
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(words.data()), static_cast<streamsize>(words.size() * sizeof(uint64_t)));
+        out.write(reinterpret_cast<const char *>(ranks.data()), static_cast<streamsize>(ranks.size() * sizeof(uint32_t)));
+        out.write(reinterpret_cast<const char *>(values.data()), static_cast<streamsize>(values.size() * sizeof(uint32_t)));
+        if (!out) return nullopt;
+        return header.num_keys;
+    }
+};
+
+// --------- MCTSNode -------------------//
+struct ScoredMove;
+
+struct MCTSNode {
+
+    MCTSNode(const shared_ptr<Board> &game_state, MCTSNode *parent, std::optional<Move> &&move) : game_state_(game_state), parent_(parent), move_(move), num_rollouts_(0),
+                                                                                                   white_win_counts_(0), black_win_count_(0),
+                                                                                                   amaf_rollouts_(0), amaf_win_counts_(0), prior_(0.0F), minimax_(0.5F),
+                                                                                                   unvisited_moves_(ALL(game_state->get_available_moves())) {
+        if (USE_SYMMETRY_PRUNING) prune_symmetric_moves();
+        std::shuffle(ALL(unvisited_moves_), RNG::thread_rng());
+        if (game_state_->is_over()) proven_winner_ = game_state_->winner();
+        children_.reserve(unvisited_moves_.size());
+    }
+
+    MCTSNode(const MCTSNode &rhs) = default;
+
+    MCTSNode(MCTSNode &&rhs) = default;
+
+    MCTSNode &operator=(const MCTSNode &rhs) = delete;
+
+    MCTSNode &operator=(MCTSNode &&rhs) = delete;
+
+    [[nodiscard]] std::optional<Move> get_move() const noexcept { return move_; }
+
+    [[nodiscard]] std::optional<Player> get_proven_winner() const noexcept { return proven_winner_; }
+
+    [[nodiscard]] Player get_turn() const noexcept { return game_state_->get_turn(); }
+
+    [[nodiscard]] MCTSNode *get_parent() const noexcept { return parent_; }
+
+    [[nodiscard]] uint32_t get_num_rollouts() const noexcept { return num_rollouts_; }
+
+    [[nodiscard]] uint32_t get_amaf_rollouts() const noexcept { return amaf_rollouts_; }
+
+    [[nodiscard]] float get_prior() const noexcept { return prior_; }
+
+    // Heuristic minimax value for the player to move (implicit minimax only).
+    [[nodiscard]] float get_minimax() const noexcept { return minimax_; }
+
+    // Prior of the move add_random_child() expands next (PUCT only).
+    [[nodiscard]] float get_next_prior() const noexcept { return unvisited_priors_.back(); }
+
+    [[nodiscard]] vector<MCTSNode> &get_children() noexcept { return children_; }
+
+    [[nodiscard]] const vector<MCTSNode> &get_children() const noexcept { return children_; }
+
+    /**
+     * Expands the last unvisited move: a random one, or the one with the highest prior once priors are set.
+     */
+    MCTSNode &add_random_child() {
+        Move &new_move = unvisited_moves_.back();
+        unvisited_moves_.pop_back();
+        shared_ptr<Board> new_game_state = std::make_shared<Board>(*game_state_);
+        assert(new_game_state != game_state_);
+        new_game_state->apply_move(new_move);
+        children_.emplace_back(new_game_state, this, make_optional(new_move));
+        if (!unvisited_priors_.empty()) {
+            children_.back().prior_ = unvisited_priors_.back();
+            unvisited_priors_.pop_back();
+        }
+        return children_.back();
+    }
+
+    /**
+     * Expands move, which must be unvisited, keeping the order of the other unvisited moves.
+     */
+    MCTSNode &add_child(const Move &move) {
+        const auto it = find(ALL(unvisited_moves_), move);
+        assert(it != unvisited_moves_.end());
+        const auto index = it - unvisited_moves_.begin();
+        rotate(it, it + 1, unvisited_moves_.end());
+        if (!unvisited_priors_.empty()) {
+            rotate(unvisited_priors_.begin() + index, unvisited_priors_.begin() + index + 1, unvisited_priors_.end());
+        }
+        return add_random_child();
+    }
+
+    [[nodiscard]] bool has_priors() const noexcept {
+        return unvisited_priors_.size() == unvisited_moves_.size();
+    }
+
+    /**
+     * Normalises the prior function's weights for the unvisited moves and sorts them by increasing prior,
+     * so that expansion takes the most promising move first (ties keep the random order).
+     */
+    void set_priors(PriorFunction prior_function) {
+        vector<float> weights;
+        prior_function(game_state_->position(), unvisited_moves_, weights);
+        float total = 0.0F;
+        for (float w : weights) total += w;
+        vector<size_t> order(unvisited_moves_.size());
+        iota(ALL(order), 0);
+        stable_sort(ALL(order), [&weights](size_t a, size_t b) { return weights[a] < weights[b]; });
+        vector<Move> moves(order.size());
+        unvisited_priors_.resize(order.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            moves[i] = unvisited_moves_[order[i]];
+            unvisited_priors_[i] = weights[order[i]] / total;
+        }
+        unvisited_moves_ = std::move(moves);
+    }
+
+    /**
+     * white_score is 1 for a white win, 0 for a black win, or white's winning chance for a cut-off rollout,
+     * summed over count rollouts.
+     */
+    void record_win(double white_score, uint32_t count = 1) noexcept {
+        white_win_counts_ += white_score;
+        black_win_count_ += count - white_score;
+        num_rollouts_ += count;
+    }
+
+    /**
+     * Credits every child whose move the player to move here played later in the game (all moves as first).
+     * @param played : lines played after this node by the player to move here.
+     */
+    void record_amaf(uint64_t played, double white_score) noexcept {
+        const double score = game_state_->get_turn() == Player::WHITE ? white_score : 1.0 - white_score;
+        for (auto &child : children_) {
+            if ((played >> line_index(child.move_.value())) & 1) {
+                ++child.amaf_rollouts_;
+                child.amaf_win_counts_ += score;
+            }
+        }
+    }
+
+    [[nodiscard]] inline bool can_add_child() const noexcept {
+        return SZ(unvisited_moves_) > 0;
+    }
+
+    [[nodiscard]] inline bool is_terminal() const noexcept {
+        return game_state_->is_over();
+    }
+
+    [[nodiscard]] inline bool is_proven() const noexcept {
+        return proven_winner_.has_value();
+    }
+
+    /**
+     * MCTS-Solver rule: a node is a proven win for the player to move if some child is, and a proven
+     * loss if every move was expanded and all children are proven wins for the opponent.
+     * @return true when this call proved the node.
+     */
+    bool update_proof() noexcept {
+        if (is_proven()) return false;
+        const Player player = game_state_->get_turn();
+        bool all_lost = unvisited_moves_.empty();
+        for (const auto &child : children_) {
+            if (child.proven_winner_ == player) {
+                proven_winner_ = player;
+                return true;
+            }
+            all_lost &= child.is_proven();
+        }
+        if (all_lost) proven_winner_ = (player == Player::WHITE) ? Player::BLACK : Player::WHITE;
+        return all_lost;
+    }
+
+    /**
+     * Implicit minimax backup: exact when proven, the best value over the expanded children otherwise, and
+     * evaluator's estimate for a leaf.
+     */
+    void update_minimax(StaticEvaluator evaluator) {
+        if (is_proven()) {
+            minimax_ = proven_winner_ == game_state_->get_turn() ? 1.0F : 0.0F;
+        } else if (children_.empty()) {
+            const Position position = game_state_->position();
+            uint64_t closing;
+            const uint64_t legal = position.legal_moves(&closing);
+            minimax_ = static_cast<float>(evaluator(position, legal, closing));
+        } else {
+            float best = 0.0F;
+            for (const auto &child : children_) {
+                best = max(best, 1.0F - child.minimax_);
+            }
+            minimax_ = best;
+        }
+    }
+
+    [[nodiscard]] double winning_frac(Player player) const noexcept {
+        double win_counts = black_win_count_;
+        if (player == Player::WHITE) win_counts = white_win_counts_;
+        return win_counts / double(num_rollouts_);
+    }
+
+    // AMAF winning fraction of the move leading here, for the player who made it.
+    [[nodiscard]] double amaf_winning_frac() const noexcept {
+        return amaf_win_counts_ / double(amaf_rollouts_);
+    }
+
+    // The n children with the best winning fraction, best first.
+    [[nodiscard]] vector<ScoredMove> top_n(size_t n) const noexcept;
+
+private:
+    shared_ptr<Board> game_state_;
+    MCTSNode *parent_;
+    optional<Move> move_;
+    uint32_t num_rollouts_;
+    double white_win_counts_;
+    double black_win_count_;
+    uint32_t amaf_rollouts_;
+    double amaf_win_counts_;
+    // Prior probability of the move leading here (PUCT only).
+    float prior_;
+    // See update_minimax().
+    float minimax_;
+    vector<Move> unvisited_moves_;
+    // Priors of unvisited_moves_, in the same order (PUCT only).
+    vector<float> unvisited_priors_;
+    vector<MCTSNode> children_;
+    optional<Player> proven_winner_;
+    template<class Selection, class Expansion, class Rollout, class Backup>
+    friend class BasicMCTSAgent;
+
+    /**
+     * Keeps one move per orbit of the symmetries that leave the position unchanged: the others lead to
+     * symmetric children with the same value. The smallest line of each orbit is kept.
+     */
+    void prune_symmetric_moves() {
+        const uint64_t drawn = game_state_->get_drawn_lines();
+        uint32_t invariant = 0;
+        for (uint32_t s = 1; s < NUM_SYMMETRIES; s++) {
+            if (is_invariant(drawn, s)) invariant |= 1U << s;
+        }
+        if (invariant == 0) return;
+        unvisited_moves_.erase(remove_if(ALL(unvisited_moves_), [invariant](const Move &move) {
+            const uint32_t line = line_index(move);
+            for (uint32_t s = 1; s < NUM_SYMMETRIES; s++) {
+                if (((invariant >> s) & 1U) && SYMMETRY_TABLES.line_map[s][line] < line) return true;
+            }
+            return false;
+        }), unvisited_moves_.end());
+    }
+};// end of struct MCTSNode.
+
+
+// --------- ScoredMove -------------------//
+struct ScoredMove {
+    double winning_fraction_;
+    const MCTSNode *node_;
+    uint32_t num_rollouts_;
+
+    ScoredMove(double wf, const MCTSNode *const node, int nr) : winning_fraction_(wf), node_(node), num_rollouts_(nr) {}
+
+    bool operator<(const ScoredMove &other) const { return winning_fraction_ > other.winning_fraction_; }
+
+    friend ostream &operator<<(ostream &out, const ScoredMove &sd) noexcept {
+        out << IO::format_move(sd.node_->get_move().value()) << ' ' << std::setprecision(2) << sd.winning_fraction_ << '('
+            << sd.num_rollouts_ << ')';
+        if (sd.node_->is_proven()) out << (sd.node_->get_proven_winner() == sd.node_->get_turn() ? 'L' : 'W');
+        return out;
+    }
+
+};// end of struct ScoredMove
+
+inline vector<ScoredMove> MCTSNode::top_n(size_t n) const noexcept {
+    vector<ScoredMove> scored_moves;
+    const size_t CHILDREN_SIZE = this->children_.size();
+    scored_moves.reserve(CHILDREN_SIZE);
+    for (size_t i = 0; i < CHILDREN_SIZE; i++) {
+        const auto &child = children_[i];
+        assert(child.move_.has_value());
+        scored_moves.emplace_back(child.winning_frac(game_state_->get_turn()), &child,
+                                  child.num_rollouts_);
+    }
+    sort(ALL(scored_moves));
+    vector<ScoredMove> top_n(scored_moves.begin(), scored_moves.begin() + min(n, CHILDREN_SIZE));
+    return top_n;
+}
+
+// --------- MCTS policies ---------------//
+// Settings of a search that policies may read at run time.
+struct MCTSSettings {
+    // UCT exploration constant.
+    double temperature;
+    bool use_rave;
+    PriorFunction prior_function;
+    bool use_widening;
+    uint32_t rollout_cutoff;
+    StaticEvaluator evaluator;
+    // Rollouts run from each expanded leaf, backed up together.
+    uint32_t rollouts_per_leaf;
+    // Weight of the implicit minimax value in the value of a child (0 ignores it).
+    double minimax_weight;
+};
+
+// Results of the rollouts run from one leaf in a round.
+struct RolloutBatch {
+    // White's score summed over count rollouts.
+    double white_score = 0.0;
+    uint32_t count = 0;
+    // White's score and the lines each player drew below the leaf, per rollout (only when the backup collects them).
+    vector<pair<double, array<uint64_t, 2>>> played;
+
+    void add(double score, const array<uint64_t, 2> &lines, bool collect_played) {
+        white_score += score;
+        ++count;
+        if (collect_played) played.emplace_back(score, lines);
+    }
+};
+
+/*
+ * The steps of an MCTS round are policies, chosen at compile time by BasicMCTSAgent's template arguments:
+ *  - Expansion: ordering(settings) is the prior function ordering a node's unvisited moves (nullptr keeps
+ *    their random order) and may_expand(node, settings) tells whether node may get a new child.
+ *  - Selection: select<Expansion>(node, settings) is the child to descend to, or nullptr to expand node.
+ *  - Rollout: simulate(board, settings, played) plays the game out and returns white's score; when played is
+ *    given, (*played)[p] collects the lines player p drew.
+ *  - Backup: backup(node, batch, settings) updates node and its ancestors with a RolloutBatch in one pass;
+ *    collects_played(settings) tells whether it needs the lines played in each rollout.
+ * The Configured* policies decide at run time from MCTSSettings, as ConfiguredMCTSAgent does for tests and
+ * benchmarks. Each of the other ones is a single variant, so an agent made of them, such as MCTSAgent, has no
+ * branch on settings in its loop.
+ */
+
+// Expands every move, in random order.
+struct FullExpansion {
+    static PriorFunction ordering(const MCTSSettings &) noexcept { return nullptr; }
+
+    static bool may_expand(const MCTSNode &node, const MCTSSettings &) noexcept { return node.can_add_child(); }
+};
+
+// Expands every move, best prior first (PUCTSelection needs priors).
+struct PriorExpansion {
+    static PriorFunction ordering(const MCTSSettings &settings) noexcept {
+        return settings.prior_function != nullptr ? settings.prior_function : heuristic_prior;
+    }
+
+    static bool may_expand(const MCTSNode &node, const MCTSSettings &) noexcept { return node.can_add_child(); }
+};
+
+/**
+ * Progressive widening: a node has at most WIDENING_K * n^WIDENING_ALPHA children after n rollouts, expanded
+ * best prior first. A node whose children are all proven may always expand, since selection skips proven children.
+ */
+struct WideningExpansion {
+    static PriorFunction ordering(const MCTSSettings &settings) noexcept { return PriorExpansion::ordering(settings); }
+
+    static bool may_expand(const MCTSNode &node, const MCTSSettings &) noexcept {
+        if (!node.can_add_child()) return false;
+        const double max_children = WIDENING_K * pow(double(node.get_num_rollouts()), WIDENING_ALPHA);
+        if (double(node.get_children().size()) < max_children) return true;
+        return all_of(ALL(node.get_children()), [](const MCTSNode &child) { return child.is_proven(); });
+    }
+};
+
+// Widening when settings.use_widening is set; moves ordered by settings.prior_function otherwise.
+struct ConfiguredExpansion {
+    static PriorFunction ordering(const MCTSSettings &settings) noexcept {
+        return settings.use_widening ? WideningExpansion::ordering(settings) : settings.prior_function;
+    }
+
+    static bool may_expand(const MCTSNode &node, const MCTSSettings &settings) noexcept {
+        return settings.use_widening ? WideningExpansion::may_expand(node, settings) : node.can_add_child();
+    }
+};
+
+// Winning fraction of child for player, blended with its AMAF winning fraction, which dominates while the child has few visits.
+inline double rave_value(const MCTSNode &child, Player player) noexcept {
+    double win_percentage = child.winning_frac(player);
+    if (child.get_amaf_rollouts() > 0) {
+        const double beta = sqrt(RAVE_EQUIVALENCE / (3.0 * child.get_num_rollouts() + RAVE_EQUIVALENCE));
+        win_percentage = (1.0 - beta) * win_percentage + beta * child.amaf_winning_frac();
+    }
+    return win_percentage;
+}
+
+// A value of child (such as its winning fraction), blended with its implicit minimax value (see MCTSNode::update_minimax).
+inline double minimax_value(const MCTSNode &child, double value, double weight) noexcept {
+    return (1.0 - weight) * value + weight * (1.0 - child.get_minimax());
+}
+
+/**
+ * UCT: expands while the expansion policy allows, then picks the child with the best
+ * value + temperature * sqrt(log N / n). Proven children are skipped: the parent of a proven win is proven
+ * itself, and proven losses need no more rollouts.
+ */
+struct UCTSelection {
+    template<class Expansion>
+    static MCTSNode *select(MCTSNode &node, const MCTSSettings &settings) noexcept {
+        if (Expansion::may_expand(node, settings)) return nullptr;
+        return select_uct(node, settings, [](const MCTSNode &child, Player player) { return child.winning_frac(player); });
+    }
+
+    template<class Value>
+    static MCTSNode *select_uct(MCTSNode &node, const MCTSSettings &settings, Value value) noexcept {
+        const double log_rollouts = log(node.get_num_rollouts());
+        const Player player = node.get_turn();
+        double best_score = -1.0;
+        MCTSNode *best_child = nullptr;
+        for (auto &child : node.get_children()) {
+            if (child.is_proven()) continue;
+            const double uct_score = value(child, player) + settings.temperature * sqrt(log_rollouts / child.get_num_rollouts());
+            if (uct_score > best_score) {
+                best_score = uct_score;
+                best_child = &child;
+            }
+        }
+        assert(best_child != nullptr);
+        return best_child;
+    }
+};
+
+// UCT on values blended with AMAF statistics (RAVE); needs RaveBackup.
+struct RaveSelection {
+    template<class Expansion>
+    static MCTSNode *select(MCTSNode &node, const MCTSSettings &settings) noexcept {
+        if (Expansion::may_expand(node, settings)) return nullptr;
+        return UCTSelection::select_uct(node, settings, rave_value);
+    }
+};
+
+// UCT on values blended with implicit minimax ones (settings.minimax_weight); needs MinimaxBackup.
+struct MinimaxSelection {
+    template<class Expansion>
+    static MCTSNode *select(MCTSNode &node, const MCTSSettings &settings) noexcept {
+        if (Expansion::may_expand(node, settings)) return nullptr;
+        return UCTSelection::select_uct(node, settings, [&settings](const MCTSNode &child, Player player) {
+            return minimax_value(child, child.winning_frac(player), settings.minimax_weight);
+        });
+    }
+};
+
+/**
+ * PUCT: Q + c * P * sqrt(N) / (1 + n). The best unvisited move competes with the expanded children with
+ * PUCT_FIRST_PLAY_VALUE as its Q and no rollouts. Needs an expansion policy that sets priors.
+ */
+struct PUCTSelection {
+    template<class Expansion>
+    static MCTSNode *select(MCTSNode &node, const MCTSSettings &settings) noexcept {
+        return select_puct<Expansion>(node, settings, [](const MCTSNode &child, Player player) { return child.winning_frac(player); });
+    }
+
+    template<class Expansion, class Value>
+    static MCTSNode *select_puct(MCTSNode &node, const MCTSSettings &settings, Value value) noexcept {
+        const double sqrt_rollouts = sqrt(double(node.get_num_rollouts()));
+        const Player player = node.get_turn();
+        const bool may_expand = Expansion::may_expand(node, settings);
+        double best_score = -1.0;
+        if (may_expand) best_score = PUCT_FIRST_PLAY_VALUE + PUCT_EXPLORATION * node.get_next_prior() * sqrt_rollouts;
+        MCTSNode *best_child = nullptr;
+        for (auto &child : node.get_children()) {
+            if (child.is_proven()) continue;
+            const double score = value(child, player) + PUCT_EXPLORATION * child.get_prior() * sqrt_rollouts / (1.0 + child.get_num_rollouts());
+            if (score > best_score) {
+                best_score = score;
+                best_child = &child;
+            }
+        }
+        assert(best_child != nullptr || may_expand);
+        return best_child;
+    }
+};
+
+/**
+ * PUCT when Puct is set, UCT otherwise; values blended with AMAF ones when Rave is set (needs RaveBackup), and
+ * with implicit minimax ones weighted by settings.minimax_weight when Minimax is set (needs MinimaxBackup).
+ */
+template<bool Puct, bool Rave, bool Minimax>
+struct FixedSelection {
+    template<class Expansion>
+    static MCTSNode *select(MCTSNode &node, const MCTSSettings &settings) noexcept {
+        auto value = [&settings](const MCTSNode &child, Player player) {
+            const double v = Rave ? rave_value(child, player) : child.winning_frac(player);
+            return Minimax ? minimax_value(child, v, settings.minimax_weight) : v;
+        };
+        if constexpr (Puct) {
+            return PUCTSelection::select_puct<Expansion>(node, settings, value);
+        } else {
+            if (Expansion::may_expand(node, settings)) return nullptr;
+            return UCTSelection::select_uct(node, settings, value);
+        }
+    }
+};
+
+/**
+ * PUCT when settings.prior_function is set, UCT otherwise; values blended with AMAF ones when settings.use_rave
+ * is set, and with implicit minimax ones when settings.minimax_weight is positive.
+ */
+struct ConfiguredSelection {
+    template<class Expansion>
+    static MCTSNode *select(MCTSNode &node, const MCTSSettings &settings) noexcept {
+        auto value = [&settings](const MCTSNode &child, Player player) {
+            const double v = settings.use_rave ? rave_value(child, player) : child.winning_frac(player);
+            return settings.minimax_weight > 0.0 ? minimax_value(child, v, settings.minimax_weight) : v;
+        };
+        if (settings.prior_function != nullptr) return PUCTSelection::select_puct<Expansion>(node, settings, value);
+        if (Expansion::may_expand(node, settings)) return nullptr;
+        return UCTSelection::select_uct(node, settings, value);
+    }
+};
+
+// Uniformly random lines until the end of the game.
+struct UniformRollout {
+    static double simulate(const Board &board, const MCTSSettings &, array<uint64_t, 2> *played) noexcept {
+        static const LineSampler uniform(1.0, 1.0);
+        Xoshiro256 &rng = RNG::thread_rng();
+        Position game = board.position();
+        const bool cached = use_legality_cache(game.get_drawn());
+        uint64_t closing;
+        for (uint64_t legal = rollout_legal_moves(game, &closing, cached); legal; legal = rollout_legal_moves(game, &closing, cached)) {
+            const uint32_t line = uniform(legal, closing, rng);
+            if (played != nullptr) (*played)[static_cast<int>(game.get_turn())] |= 1ULL << line;
+            game.apply_move(line);
+        }
+        // The player left without a move loses.
+        return game.get_turn() == Player::WHITE ? 0.0 : 1.0;
+    }
+};
+
+// Heavy playouts (see HeavyPlayoutAgent) for both players until the end of the game.
+struct HeavyRollout {
+    static double simulate(const Board &board, const MCTSSettings &, array<uint64_t, 2> *played) noexcept {
+        static const LineSampler uniform(1.0, 1.0);
+        Xoshiro256 &rng = RNG::thread_rng();
+        Position game = board.position();
+        const bool cached = use_legality_cache(game.get_drawn());
+        uint64_t closing;
+        for (uint64_t legal = rollout_legal_moves(game, &closing, cached); legal; legal = rollout_legal_moves(game, &closing, cached)) {
+            const uint32_t line = HeavyPlayoutAgent::select_line(game, legal, closing, uniform, rng);
+            if (played != nullptr) (*played)[static_cast<int>(game.get_turn())] |= 1ULL << line;
+            game.apply_move(line);
+        }
+        return game.get_turn() == Player::WHITE ? 0.0 : 1.0;
+    }
+};
+
+/**
+ * Each colour weights closing moves and plays heavy playouts as configured by its *_USE_WEIGHT_ROLLOUT and
+ * *_USE_HEAVY_ROLLOUT flags. When Cutoff is set and settings.rollout_cutoff is positive, the game is scored by
+ * the static evaluator after that many plies.
+ */
+template<bool Cutoff>
+struct PlayerRollout {
+    static double simulate(const Board &board, const MCTSSettings &settings, array<uint64_t, 2> *played) noexcept {
+        static const LineSampler uniform(1.0, 1.0);
+        static const LineSampler weighted(WEIGHT_CLOSE_REGION_MOVE, WEIGHT_REGULAR_MOVE);
+        const LineSampler &white_sampler = WHITE_USE_WEIGHT_ROLLOUT ? weighted : uniform;
+        const LineSampler &black_sampler = BLACK_USE_WEIGHT_ROLLOUT ? weighted : uniform;
+        Xoshiro256 &rng = RNG::thread_rng();
+        Position game = board.position();
+        const bool cached = use_legality_cache(game.get_drawn());
+        for (uint32_t ply = 0;; ply++) {
+            uint64_t closing;
+            const uint64_t legal = rollout_legal_moves(game, &closing, cached);
+            if (!legal) break;
+            const Player turn = game.get_turn();
+            if (Cutoff && ply == settings.rollout_cutoff && ply > 0) {
+                const double score = settings.evaluator(game, legal, closing);
+                return turn == Player::WHITE ? score : 1.0 - score;
+            }
+            const LineSampler &sampler = turn == Player::WHITE ? white_sampler : black_sampler;
+            const bool heavy = turn == Player::WHITE ? WHITE_USE_HEAVY_ROLLOUT : BLACK_USE_HEAVY_ROLLOUT;
+            const uint32_t line = heavy ? HeavyPlayoutAgent::select_line(game, legal, closing, sampler, rng)
+                                        : sampler(legal, closing, rng);
+            if (played != nullptr) (*played)[static_cast<int>(turn)] |= 1ULL << line;
+            game.apply_move(line);
+        }
+        return game.get_turn() == Player::WHITE ? 0.0 : 1.0;
+    }
+};
+
+/**
+ * Adds the batch to node and its ancestors in one pass, and proofs for as long as they keep proving parents.
+ * With amaf, also all-moves-as-first statistics: each rollout's played[p] holds the lines player p drew below
+ * node. With minimax, also implicit minimax values, from settings.evaluator at the leaf (see
+ * MCTSNode::update_minimax). The backup policies pass constants, which the compiler folds.
+ */
+inline void backup_path(MCTSNode *node, RolloutBatch &batch, const MCTSSettings &settings, bool amaf, bool minimax) {
+    bool proving = node->is_proven();
+    for (; node != nullptr; node = node->get_parent()) {
+        node->record_win(batch.white_score, batch.count);
+        if (amaf) {
+            for (const auto &[white_score, played] : batch.played) {
+                node->record_amaf(played[static_cast<int>(node->get_turn())], white_score);
+            }
+        }
+        if (minimax) node->update_minimax(settings.evaluator);
+        if (node->get_parent() != nullptr) {
+            if (amaf) {
+                const uint64_t line = 1ULL << line_index(node->get_move().value());
+                for (auto &[_, played] : batch.played) {
+                    played[static_cast<int>(node->get_parent()->get_turn())] |= line;
+                }
+            }
+            if (proving) proving = node->get_parent()->update_proof();
+        }
+    }
+}
+
+// PlayerRollout with the cutoff read from settings (see BasicMCTSAgent::set_rollout_cutoff).
+using ConfiguredRollout = PlayerRollout<true>;
+
+// Adds the score to node and its ancestors, and proofs for as long as they keep proving parents.
+struct MeanBackup {
+    static bool collects_played(const MCTSSettings &) noexcept { return false; }
+
+    static void backup(MCTSNode *node, RolloutBatch &batch, const MCTSSettings &settings) {
+        backup_path(node, batch, settings, false, false);
+    }
+};
+
+// MeanBackup plus all-moves-as-first statistics.
+struct RaveBackup {
+    static bool collects_played(const MCTSSettings &) noexcept { return true; }
+
+    static void backup(MCTSNode *node, RolloutBatch &batch, const MCTSSettings &settings) {
+        backup_path(node, batch, settings, true, false);
+    }
+};
+
+// MeanBackup plus implicit minimax values.
+struct MinimaxBackup {
+    static bool collects_played(const MCTSSettings &) noexcept { return false; }
+
+    static void backup(MCTSNode *node, RolloutBatch &batch, const MCTSSettings &settings) {
+        backup_path(node, batch, settings, false, true);
+    }
+};
+
+// MeanBackup plus all-moves-as-first statistics and implicit minimax values.
+struct RaveMinimaxBackup {
+    static bool collects_played(const MCTSSettings &) noexcept { return true; }
+
+    static void backup(MCTSNode *node, RolloutBatch &batch, const MCTSSettings &settings) {
+        backup_path(node, batch, settings, true, true);
+    }
+};
+
+// RaveBackup when settings.use_rave is set, MeanBackup otherwise; minimax values too when settings.minimax_weight is positive.
+struct ConfiguredBackup {
+    static bool collects_played(const MCTSSettings &settings) noexcept { return settings.use_rave; }
+
+    static void backup(MCTSNode *node, RolloutBatch &batch, const MCTSSettings &settings) {
+        backup_path(node, batch, settings, settings.use_rave, settings.minimax_weight > 0.0);
+    }
+};
+
+// --------- MCTS AGENT ---------------//
+/**
+ * Monte Carlo tree search over the policies given as template arguments (see MCTS policies above); MCTSAgent
+ * is the instantiation configured by config.hpp, and ConfiguredMCTSAgent the one configured at run time.
+ */
+template<class Selection, class Expansion, class Rollout, class Backup>
+class BasicMCTSAgent : public Agent {
+    uint32_t num_rounds_;
+    unique_ptr<TimeStrategy> ts_;
+    thread ponder_thread_;
+    atomic<bool> stop_pondering_;
+
+public:
+    // Aggregated statistics of one root move over all search trees.
+    struct RootStats {
+        Move move;
+        uint32_t num_rollouts;
+        double winning_frac;
+        optional<Player> proven_winner;
+        // Rollouts in which the move was played at any point by the player to move (RAVE only).
+        uint32_t amaf_rollouts;
+    };
+
+    /**
+     * @param num_rounds : maximum number of rollouts per search tree and move.
+     * @param num_threads : number of search trees, each grown by its own thread (root parallelization).
+     * @param seed : when given, search is deterministic: every tree uses a stream derived from seed and the
+     *               position, exactly num_rounds rollouts are run and nothing is kept between moves.
+     * @param use_rave : blend AMAF statistics into child selection (see RAVE_EQUIVALENCE).
+     * @param prior_function : when given, children are selected with PUCT using these move priors instead of UCT.
+     * @param use_widening : limit the number of children by the node's rollouts (see WIDENING_K); moves are
+     *                       then expanded in order of prior_function, or of heuristic_prior under UCT.
+     * The last three are only read by the policies that use them (see ConfiguredSelection and ConfiguredExpansion,
+     * as in ConfiguredMCTSAgent).
+     */
+    BasicMCTSAgent(uint32_t num_rounds, double temperature, unique_ptr<TimeStrategy> &ts, Player color,
+                   uint32_t num_threads = 1, optional<uint64_t> seed = nullopt, bool use_rave = USE_RAVE,
+                   PriorFunction prior_function = USE_PUCT ? heuristic_prior : nullptr,
+                   bool use_widening = USE_PROGRESSIVE_WIDENING) : Agent(color),
+                                                                   num_rounds_(num_rounds),
+                                                                   ts_(std::move(ts)),
+                                                                   stop_pondering_(false),
+                                                                   seed_(seed),
+                                                                   settings_{temperature, use_rave, prior_function, use_widening,
+                                                                             ROLLOUT_CUTOFF_PLIES, parity_evaluator, ROLLOUTS_PER_LEAF,
+                                                                             IMPLICIT_MINIMAX_WEIGHT},
+                                                                   roots_(max(1U, num_threads)) {}
+
+    BasicMCTSAgent(const BasicMCTSAgent &rhs) = delete;
+
+    BasicMCTSAgent(BasicMCTSAgent &&rhs) = delete;
+
+    BasicMCTSAgent &operator=(const BasicMCTSAgent &rhs) = delete;
+
+    BasicMCTSAgent &operator=(BasicMCTSAgent &&rhs) = delete;
+
+    ~BasicMCTSAgent() override { stop_pondering(); }
+
+    pair<Move, bool> select_move(const Board &game_state, const Context &ctx) override {
+        assert(color_ == game_state.get_turn());
+        stop_pondering();
+        Timer timer = Timer().start();
+        const bool timed = !seed_.has_value();
+        // Time other agents spent on this move comes out of the search's.
+        const double spent = ctx.count(CTX_VAR::MOVE_ELAPSED_MILLIS) ? ctx.at(CTX_VAR::MOVE_ELAPSED_MILLIS) : 0.0;
+        // Set by the first tree from its instability and read by all of them.
+        atomic<double> max_move_time(max(0.0, ts_->max_move_time(ctx) - spent));
+        optional<Deadline> deadline;
+        if (timed) deadline.emplace(max_move_time.load());
+        const MCTSNode *leading = nullptr;
+        double last_change = 0.0;
+        // At least one batch of rounds runs, so that the root has a child to pick even when time is short.
+        auto stop = [&](size_t t, uint32_t i, const MCTSNode &root) {
+            if (!timed || i == 0) return false;
+            // Once expired, the deadline stays so: the relaxed load is all most rounds pay.
+            if (deadline->expired()) return true;
+            if (t == 0 && i % INSTABILITY_INTERVAL == 0) {
+                const double elapsed = timer.elapsed_micro() / 1000.0;
+                const auto [leader, gap] = best_child(root);
+                if (leader != leading) last_change = elapsed;
+                leading = leader;
+                const double adjusted = ts_->adjust_move_time(ctx, {spent + elapsed, spent + last_change, gap});
+                max_move_time.store(max(0.0, adjusted - spent));
+                deadline->reset(max_move_time.load());
+            }
+            if (!USE_EARLY_STOP || i % EARLY_STOP_INTERVAL != 0) return false;
+            // Rollouts left until the rollout or time limit, at the speed so far.
+            const double elapsed = max(timer.elapsed_micro() / 1000.0, 1e-3);
+            const double rollouts = double(i) * settings_.rollouts_per_leaf;
+            const double remaining = min(num_rounds_ - rollouts, rollouts * (max_move_time.load() - elapsed) / elapsed);
+            return is_settled(root, remaining);
+        };
+        // Sequential halving needs its rollout budget up front: in a timed search, what the time allows at the
+        // speed of the last search.
+        uint32_t halving_budget = 0;
+        if (!timed && halving_max_millis_ > 0.0) {
+            halving_budget = num_rounds_;
+        } else if (timed && max_move_time.load() <= halving_max_millis_) {
+            halving_budget = static_cast<uint32_t>(min(double(num_rounds_), max_move_time.load() * rollouts_per_milli_));
+        }
+        survivors_.assign(SZ(roots_), {});
+        const uint32_t rollouts = grow_trees(game_state, num_rounds_, stop, halving_budget);
+        if (timed && rollouts > 0) rollouts_per_milli_ = rollouts / max(timer.elapsed_micro() / 1000.0, 1.0);
+
+#ifndef QUIET_MODE
+        cerr << "[I]: num_rounds: " << roots_[0]->num_rollouts_ << "/" << num_rounds_ << " x " << SZ(roots_) << " trees" << endl;
+
+        auto scored_moves = roots_[0]->top_n(TOP_N_FIRST_LEVEL);
+
+        cerr << "[I]: Top " << SZ(scored_moves) << " moves:\n";
+
+        for (auto &score : scored_moves) {
+            cerr << "[I]: " << score << "\n";
+
+            auto sl_scored_moves = score.node_->top_n(TOP_N_SECOND_LEVEL);
+
+            cerr << "[I]:\t\t";
+            for (auto &score2 : sl_scored_moves) {
+                cerr << score2 << ",";
+            }
+            cerr << "\n";
+        }
+
+        cerr.flush();
+#endif
+
+        // A proven win beats any statistic; a proven loss is only played when nothing else is left.
+        const Player player = game_state.get_turn();
+        auto rank = [player](const RootStats &rs) {
+            if (!rs.proven_winner.has_value()) return 1;
+            return rs.proven_winner == player ? 2 : 0;
+        };
+        // After sequential halving, only the moves it kept (or a proven win) are candidates.
+        auto kept = [this](const RootStats &rs) {
+            return all_of(ALL(survivors_), [](const vector<Move> &moves) { return moves.empty(); }) ||
+                   any_of(ALL(survivors_), [&rs](const vector<Move> &moves) { return find(ALL(moves), rs.move) != moves.end(); });
+        };
+        const auto stats = root_stats();
+        const RootStats *best = nullptr;
+        for (const auto &child : stats) {
+            if (rank(child) < 2 && !kept(child)) continue;
+            if (best == nullptr || rank(child) > rank(*best) ||
+                (rank(child) == rank(*best) && child.winning_frac > best->winning_frac)) {
+                best = &child;
+            }
+        }
+        assert(best != nullptr);
+        const Move best_move = best->move;
+        const double best_pct = best->winning_frac;
+        const bool proven_win = rank(*best) == 2;
+        // Claimed on every move that looks won; game_loop sends only the first claim of the game.
+        const bool is_winning = proven_win || ((best_pct > IS_WINNING_THRESHOLD) && (ctx.at(CTX_VAR::ROUND) >= MIN_ROUND_TO_CLAIM_IS_WINNING));
+
+#ifndef QUIET_MODE
+        timer.stop();
+        cerr << "[I]: Selected: " << IO::format_move(best_move) << (is_winning ? "!" : "") << " in "
+             << timer.elapsed_milli() << " ms." << endl;
+#endif
+        return make_pair(best_move, is_winning);
+    }
+
+    /**
+     * Stops rollouts after max_plies plies (0 plays them to the end) and scores them with evaluator
+     * (PlayerRollout<true> only, as in ConfiguredMCTSAgent). Must not be called while pondering.
+     */
+    void set_rollout_cutoff(uint32_t max_plies, StaticEvaluator evaluator = parity_evaluator) {
+        settings_.rollout_cutoff = max_plies;
+        settings_.evaluator = evaluator;
+    }
 
-        MCTSNode(MCTSNode &&rhs) = default;
+    /**
+     * Searches the root with sequential halving when a move is given at most max_millis (0: never), or always
+     * in deterministic mode when max_millis is positive; see SEQUENTIAL_HALVING_MAX_MILLIS.
+     */
+    void set_sequential_halving(double max_millis) { halving_max_millis_ = max_millis; }
+
+    /**
+     * Blends implicit minimax values into child values with this weight, 0 turning them off (see
+     * IMPLICIT_MINIMAX_WEIGHT). Read by MinimaxSelection and ConfiguredSelection, whose backups must then compute
+     * minimax values (MinimaxBackup and ConfiguredBackup). Must not be called while pondering.
+     */
+    void set_minimax_weight(double weight) { settings_.minimax_weight = weight; }
 
-        MCTSNode &operator=(const MCTSNode &rhs) = delete;
+    /**
+     * Runs count rollouts from every expanded leaf and backs them up together (see ROLLOUTS_PER_LEAF). Must not
+     * be called while pondering.
+     */
+    void set_rollouts_per_leaf(uint32_t count) { settings_.rollouts_per_leaf = max(1U, count); }
 
-        MCTSNode &operator=(MCTSNode &&rhs) = delete;
+    // Proves new nodes found in tablebase (nullptr for none), which must outlive the agent. Must not be called while pondering.
+    void set_tablebase(const Tablebase *tablebase) { tablebase_ = tablebase; }
 
-        [[nodiscard]] std::optional<Move> get_move() const noexcept { return move_; }
+    /**
+     * Searches the position after our move on a background thread until stop_pondering() is called.
+     * When the opponent's reply arrives, select_move() continues from the matching subtree.
+     * Disabled in deterministic mode, where trees must not depend on the opponent's thinking time.
+     */
+    void start_pondering(const Board &game_state, const Context &) override {
+        stop_pondering();
+        if (game_state.is_over() || seed_.has_value()) return;
+        stop_pondering_.store(false);
+        ponder_thread_ = thread([this, game_state]() {
+            grow_trees(game_state, MAX_PONDER_ROUNDS, [this](size_t, uint32_t, const MCTSNode &) {
+                return stop_pondering_.load(memory_order_relaxed);
+            });
+        });
+    }
 
-        MCTSNode &add_random_child() {
-            Move &new_move = unvisited_moves_.back();
-            unvisited_moves_.pop_back();
-            shared_ptr<Board> new_game_state = std::make_shared<Board>(*game_state_);
-            assert(new_game_state != game_state_);
-            new_game_state->apply_move(new_move);
-            children_.emplace_back(new_game_state, this, make_optional(new_move), rng_);
-            return children_.back();
+    void stop_pondering() override {
+        if (ponder_thread_.joinable()) {
+            stop_pondering_.store(true);
+            ponder_thread_.join();
+#ifndef QUIET_MODE
+            cerr << "[I]: pondered " << roots_[0]->num_rollouts_ << " rollouts." << endl;
+#endif
         }
+    }
 
-        void record_win(Player winner) noexcept {
-            if (winner == Player::WHITE) ++white_win_counts_;
-            else
-                ++black_win_count_;
-            ++num_rollouts_;
+    /**
+     * Statistics of every root move of the last search, summed over all trees.
+     */
+    [[nodiscard]] vector<RootStats> root_stats() const {
+        vector<RootStats> stats;
+        vector<double> win_counts;
+        for (const auto &root : roots_) {
+            if (root == nullptr) continue;
+            const Player player = root->game_state_->get_turn();
+            for (const auto &child : root->children_) {
+                assert(child.move_.has_value());
+                auto it = find_if(ALL(stats), [&child](const RootStats &rs) { return rs.move == child.move_.value(); });
+                if (it == stats.end()) {
+                    stats.push_back({child.move_.value(), 0, 0.0, nullopt, 0});
+                    win_counts.push_back(0.0);
+                    it = stats.end() - 1;
+                }
+                it->num_rollouts += child.num_rollouts_;
+                it->amaf_rollouts += child.amaf_rollouts_;
+                if (child.is_proven()) it->proven_winner = child.proven_winner_;
+                if (child.num_rollouts_ > 0) win_counts[it - stats.begin()] += child.winning_frac(player) * child.num_rollouts_;
+            }
+        }
+        // A move no tree has visited yet (a sequential halving candidate cut short, or a proven child) scores 0.
+        for (size_t i = 0; i < stats.size(); i++) {
+            stats[i].winning_frac = stats[i].num_rollouts > 0 ? win_counts[i] / stats[i].num_rollouts : 0.0;
+        }
+        return stats;
+    }
+
+private:
+    optional<uint64_t> seed_;
+    MCTSSettings settings_;
+    const Tablebase *tablebase_ = nullptr;
+    double halving_max_millis_ = SEQUENTIAL_HALVING_MAX_MILLIS;
+    // Speed of the last timed search on the first tree, which sets the sequential halving budget.
+    double rollouts_per_milli_ = SEQUENTIAL_HALVING_ROLLOUTS_PER_MILLI;
+    // Root moves each tree kept after sequential halving, best first (empty when it was not used).
+    vector<vector<Move>> survivors_;
+
+    // One search tree per thread, kept between moves (and grown while pondering).
+    vector<unique_ptr<MCTSNode>> roots_;
+
+    /**
+     * Grows every tree from game_state, one thread per tree, for at most max_rounds rollouts each or
+     * until stop(t, i, root) is true at round i of tree t. A positive halving_budget runs that many
+     * rollouts of sequential halving instead, leaving the kept root moves in survivors_.
+     * @return the number of rollouts run on the first tree.
+     */
+    template<class Stop>
+    uint32_t grow_trees(const Board &game_state, uint32_t max_rounds, const Stop &stop, uint32_t halving_budget = 0) {
+        const uint64_t position_seed = seed_.has_value() ? seed_.value() ^ game_state.hash() : 0;
+        // Trees stop together once one of them proves the root, except in deterministic mode where that
+        // would make each tree depend on the others' speed.
+        atomic<bool> solved(false);
+        uint32_t first_tree_rollouts = 0;
+        auto worker = [&](size_t t) {
+            if (seed_.has_value()) {
+                RNG::thread_rng() = RNG::stream(position_seed, t);
+                roots_[t] = make_unique<MCTSNode>(make_shared<Board>(game_state), nullptr, make_optional<Move>());
+            }
+            MCTSNode &root = reuse_or_create_root(roots_[t], game_state);
+            uint32_t i = 0;
+            // Runs round i below node unless the search is over.
+            auto round = [&](MCTSNode &node) {
+                if (root.is_proven()) {
+                    solved.store(true);
+                    return false;
+                }
+                if (stop(t, i, root) || (!seed_.has_value() && solved.load(memory_order_relaxed))) return false;
+                run_round(node);
+                i++;
+                return true;
+            };
+            if (halving_budget > 0) {
+                survivors_[t] = sequential_halving(root, halving_budget, round);
+            } else {
+                while (i * settings_.rollouts_per_leaf < max_rounds && round(root)) {}
+            }
+            if (t == 0) first_tree_rollouts = i * settings_.rollouts_per_leaf;
+        };
+        vector<thread> helpers;
+        for (size_t t = 1; t < roots_.size(); t++) {
+            helpers.emplace_back(worker, t);
+        }
+        worker(0);
+        for (auto &helper : helpers) {
+            helper.join();
         }
+        return first_tree_rollouts;
+    }
 
-        [[nodiscard]] inline bool can_add_child() const noexcept {
-            return SZ(unvisited_moves_) > 0;
+    /**
+     * Sequential halving at the root (as in Gumbel MuZero): samples SEQUENTIAL_HALVING_CANDIDATES root moves
+     * without replacement, in proportion to heuristic_prior (Gumbel top-k), then over log2(candidates) phases
+     * gives every remaining candidate an equal share of budget and keeps the better half. round(child) runs an
+     * ordinary round below child and returns false once the search must stop.
+     * @return the candidates still in the running that were visited or proven, best first.
+     */
+    template<class Round>
+    vector<Move> sequential_halving(MCTSNode &root, uint32_t budget, const Round &round) const {
+        vector<Move> moves(ALL(root.unvisited_moves_));
+        for (const auto &child : root.children_) {
+            moves.push_back(child.move_.value());
+        }
+        vector<float> weights;
+        heuristic_prior(root.game_state_->position(), moves, weights);
+        uniform_real_distribution<double> uniform(numeric_limits<double>::min(), 1.0);
+        vector<pair<double, Move>> keys;
+        for (size_t i = 0; i < moves.size(); i++) {
+            keys.emplace_back(log(weights[i]) - log(-log(uniform(RNG::thread_rng()))), moves[i]);
+        }
+        const size_t num_candidates = min(keys.size(), size_t(SEQUENTIAL_HALVING_CANDIDATES));
+        partial_sort(keys.begin(), keys.begin() + num_candidates, keys.end(), greater<>());
+        vector<MCTSNode *> candidates;
+        for (size_t i = 0; i < num_candidates; i++) {
+            const Move &move = keys[i].second;
+            auto it = find_if(ALL(root.children_), [&move](const MCTSNode &child) { return child.move_ == move; });
+            if (it != root.children_.end()) {
+                candidates.push_back(&*it);
+                continue;
+            }
+            MCTSNode &child = root.add_child(move);
+            if (tablebase_ != nullptr && !child.is_proven()) probe_tablebase(child);
+            candidates.push_back(&child);
         }
 
-        [[nodiscard]] inline bool is_terminal() const noexcept {
-            return game_state_->is_over();
+        const Player player = root.get_turn();
+        auto value = [player](const MCTSNode *child) {
+            if (child->is_proven()) return child->proven_winner_ == player ? 2.0 : -1.0;
+            return child->num_rollouts_ == 0 ? 0.0 : child->winning_frac(player);
+        };
+        const auto num_phases = static_cast<uint32_t>(ceil(log2(max(candidates.size(), size_t(2)))));
+        bool stopped = false;
+        do {
+            const auto visits = max<size_t>(1, budget / (num_phases * candidates.size() * settings_.rollouts_per_leaf));
+            for (size_t v = 0; v < visits && !stopped; v++) {
+                for (MCTSNode *candidate : candidates) {
+                    if (candidate->is_proven()) continue;
+                    if (!round(*candidate)) {
+                        stopped = true;
+                        break;
+                    }
+                }
+            }
+            stable_sort(ALL(candidates), [&value](const MCTSNode *a, const MCTSNode *b) { return value(a) > value(b); });
+            if (!stopped) candidates.resize((candidates.size() + 1) / 2);
+        } while (!stopped && candidates.size() > 1);
+        vector<Move> survivors;
+        for (const MCTSNode *candidate : candidates) {
+            // A search stopped partway through a phase can leave candidates without a single rollout.
+            if (candidate->num_rollouts_ > 0 || candidate->is_proven()) survivors.push_back(candidate->move_.value());
         }
+        return survivors;
+    }
 
-        [[nodiscard]] double winning_frac(Player player) const noexcept {
-            double win_counts = black_win_count_;
-            if (player == Player::WHITE) win_counts = white_win_counts_;
-            return win_counts / double(num_rollouts_);
+    /**
+     * Child of root with the best winning fraction (proven losses last), and its lead over the second best.
+     */
+    static pair<const MCTSNode *, double> best_child(const MCTSNode &root) noexcept {
+        const Player player = root.game_state_->get_turn();
+        auto value = [player](const MCTSNode &child) {
+            return child.is_proven() ? (child.proven_winner_ == player ? 2.0 : -1.0) : child.winning_frac(player);
+        };
+        const MCTSNode *best = nullptr;
+        double best_value = -2.0, second_value = -2.0;
+        for (const auto &child : root.children_) {
+            const double v = value(child);
+            if (v > best_value) {
+                second_value = best_value;
+                best_value = v;
+                best = &child;
+            } else {
+                second_value = max(second_value, v);
+            }
         }
+        return make_pair(best, second_value < -1.0 ? 1.0 : best_value - second_value);
+    }
 
-        [[nodiscard]] vector<ScoredMove> top_n(size_t n) const noexcept {
-            vector<ScoredMove> scored_moves;
-            const size_t CHILDREN_SIZE = this->children_.size();
-            scored_moves.reserve(CHILDREN_SIZE);
-            for (size_t i = 0; i < CHILDREN_SIZE; i++) {
-                const auto &child = children_[i];
-                assert(child.move_.has_value());
-                scored_moves.emplace_back(child.winning_frac(game_state_->get_turn()), &child,
-                                          child.num_rollouts_);
+    /**
+     * True if the most visited child of root has the best winning fraction and leads every other child by
+     * more than remaining visits, so that no other move could become the best in the remaining rounds.
+     */
+    static bool is_settled(const MCTSNode &root, double remaining) noexcept {
+        const Player player = root.game_state_->get_turn();
+        const MCTSNode *most_visited = nullptr;
+        uint32_t runner_up_rollouts = 0;
+        for (const auto &child : root.children_) {
+            if (most_visited == nullptr || child.num_rollouts_ > most_visited->num_rollouts_) {
+                if (most_visited != nullptr) runner_up_rollouts = most_visited->num_rollouts_;
+                most_visited = &child;
+            } else {
+                runner_up_rollouts = max(runner_up_rollouts, child.num_rollouts_);
             }
-            sort(ALL(scored_moves));
-            vector<ScoredMove> top_n(scored_moves.begin(), scored_moves.begin() + min(n, CHILDREN_SIZE));
-            return top_n;
         }
+        if (most_visited == nullptr || root.can_add_child()) return false;
+        for (const auto &child : root.children_) {
+            if (child.winning_frac(player) > most_visited->winning_frac(player)) return false;
+        }
+        return most_visited->num_rollouts_ - runner_up_rollouts > remaining;
+    }
+
+    // Proves node when its position is in the tablebase.
+    void probe_tablebase(MCTSNode &node) const {
+        const auto num_legal = static_cast<uint32_t>(node.game_state_->get_available_moves().size());
+        if (num_legal > tablebase_->max_moves()) return;
+        if (const optional<bool> win = tablebase_->probe(node.game_state_->position(), num_legal)) {
+            const Player player = node.get_turn();
+            node.proven_winner_ = *win ? player : (player == Player::WHITE ? Player::BLACK : Player::WHITE);
+        }
+    }
 
-    private:
-        shared_ptr<Board> game_state_;
-        MCTSNode *const parent_;
-        optional<Move> move_;
-        mt19937 &rng_;
-        uint32_t num_rollouts_;
-        uint32_t white_win_counts_;
-        uint32_t black_win_count_;
-        vector<Move> unvisited_moves_;
-        vector<MCTSNode> children_;
-        friend class MCTSAgent;
-    };// end of struct MCTSNode.
+    /**
+     * Runs one MCTS iteration (selection, expansion, simulation and backpropagation) from root.
+     */
+    void run_round(MCTSNode &root) const {
+        MCTSNode *node = &root;
+        const PriorFunction ordering = Expansion::ordering(settings_);
+        while (!node->is_terminal()) {
+            if (ordering != nullptr && !node->has_priors()) node->set_priors(ordering);
+            MCTSNode *child = Selection::template select<Expansion>(*node, settings_);
+            if (child == nullptr) break;
+            node = child;
+        }
 
+        // Add a new child node into the tree.
+        if (node->can_add_child()) {
+            node = &node->add_random_child();
+            if (tablebase_ != nullptr && !node->is_proven()) probe_tablebase(*node);
+        }
 
-    // --------- ScoredMove -------------------//
-    struct ScoredMove {
-        double winning_fraction_;
-        const MCTSNode *node_;
-        uint32_t num_rollouts_;
+        // Simulate random games from this node, so that one walk through the tree serves several rollouts;
+        // played[p] collects the lines player p draws when the backup needs them. A proven node needs no
+        // simulation: its score is exact.
+        const bool collect_played = Backup::collects_played(settings_);
+        RolloutBatch batch;
+        for (uint32_t r = 0; r < settings_.rollouts_per_leaf; r++) {
+            array<uint64_t, 2> played = {0, 0};
+            const double white_score = node->is_proven() ? (node->proven_winner_ == Player::WHITE ? 1.0 : 0.0)
+                                                         : Rollout::simulate(*node->game_state_, settings_,
+                                                                             collect_played ? &played : nullptr);
+            batch.add(white_score, played, collect_played);
+        }
 
-        ScoredMove(double wf, const MCTSNode *const node, int nr) : winning_fraction_(wf), node_(node), num_rollouts_(nr) {}
+        Backup::backup(node, batch, settings_);
+    }
 
-        bool operator<(const ScoredMove &other) const { return winning_fraction_ > other.winning_fraction_; }
+    /**
+     * Finds game_state in the last search tree (at most two plies below its root) and makes that
+     * subtree the new root. Starts a new tree when the position is not there.
+     */
+    static MCTSNode &reuse_or_create_root(unique_ptr<MCTSNode> &root, const Board &game_state) {
+        if (root != nullptr && *root->game_state_ == game_state) return *root;
+        if (root != nullptr) {
+            for (auto &child : root->children_) {
+                if (*child.game_state_ == game_state) return promote_to_root(root, child);
+                for (auto &grandchild : child.children_) {
+                    if (*grandchild.game_state_ == game_state) return promote_to_root(root, grandchild);
+                }
+            }
+        }
+        root = make_unique<MCTSNode>(make_shared<Board>(game_state), nullptr, make_optional<Move>());
+        return *root;
+    }
 
-        friend ostream &operator<<(ostream &out, const ScoredMove &sd) noexcept {
-            out << IO::format_move(sd.node_->get_move().value()) << ' ' << std::setprecision(2) << sd.winning_fraction_ << '('
-                << sd.num_rollouts_ << ')';
-            return out;
+    static MCTSNode &promote_to_root(unique_ptr<MCTSNode> &root, MCTSNode &node) {
+        auto new_root = make_unique<MCTSNode>(std::move(node));
+        new_root->parent_ = nullptr;
+        for (auto &child : new_root->children_) {
+            child.parent_ = new_root.get();
         }
+        root = std::move(new_root);
+        return *root;
+    }
+};// End of class BasicMCTSAgent
+
+// The agent configured by config.hpp, with every policy chosen at compile time.
+using MCTSAgent = BasicMCTSAgent<
+        FixedSelection<USE_PUCT, USE_RAVE, (IMPLICIT_MINIMAX_WEIGHT > 0.0)>,
+        conditional_t<USE_PROGRESSIVE_WIDENING, WideningExpansion, conditional_t<USE_PUCT, PriorExpansion, FullExpansion>>,
+        PlayerRollout<(ROLLOUT_CUTOFF_PLIES > 0)>,
+        conditional_t<USE_RAVE,
+                      conditional_t<(IMPLICIT_MINIMAX_WEIGHT > 0.0), RaveMinimaxBackup, RaveBackup>,
+                      conditional_t<(IMPLICIT_MINIMAX_WEIGHT > 0.0), MinimaxBackup, MeanBackup>>>;
 
-    };// end of struct ScoredMove
+// An agent whose policies read MCTSSettings at run time, for tests and benchmarks that compare variants.
+using ConfiguredMCTSAgent = BasicMCTSAgent<ConfiguredSelection, ConfiguredExpansion, ConfiguredRollout, ConfiguredBackup>;
+
+// --------- EndgameSolver ---------------//
+/**
+ * Exact win/loss search (negamax; with only two outcomes alpha-beta reduces to cutting at the first winning
+ * move) with make/unmake on Position, a transposition table and closing moves tried first.
+ */
+class EndgameSolver {
+    // Table entries are the drawn lines of a solved position plus a valid and a result bit.
+    static constexpr uint64_t TT_VALID = 1ULL << 63;
+    static constexpr uint64_t TT_WIN = 1ULL << 62;
+
+    vector<uint64_t> tt_;
+    const Tablebase *tablebase_ = nullptr;
+    uint64_t nodes_ = 0;
+    uint64_t max_nodes_ = 0;
+    const Deadline *deadline_ = nullptr;
+    bool aborted_ = false;
+
+    // True if the player to move wins.
+    bool wins(Position &position) {
+        if (++nodes_ > max_nodes_ || (deadline_ != nullptr && deadline_->expired())) {
+            aborted_ = true;
+            return false;
+        }
+        uint64_t closing;
+        const uint64_t legal = position.legal_moves(&closing);
+        if (!legal) return false;
+
+        uint64_t &entry = tt_[position.hash() & (tt_.size() - 1)];
+        if ((entry & TT_VALID) && (entry & ALL_LINES) == position.get_drawn()) return entry & TT_WIN;
+
+        const optional<bool> known = tablebase_ != nullptr ? tablebase_->probe(position, __builtin_popcountll(legal)) : nullopt;
+        bool win = known.value_or(false);
+        for (uint64_t moves : {legal & closing, legal & ~closing}) {
+            if (known.has_value()) break;
+            for (; moves && !win; moves &= moves - 1) {
+                const Position saved = position;
+                position.apply_move(__builtin_ctzll(moves));
+                win = !wins(position);
+                position = saved;
+                if (aborted_) return false;
+            }
+        }
+        entry = position.get_drawn() | TT_VALID | (win ? TT_WIN : 0);
+        return win;
+    }
 
 public:
-    MCTSAgent(uint32_t num_rounds, double temperature, unique_ptr<TimeStrategy> &ts, Player color, mt19937 &rng) : Agent(color),
-                                                                                                                   num_rounds_(num_rounds),
-                                                                                                                   temperature_(temperature),
-                                                                                                                   ts_(std::move(ts)),
-                                                                                                                   rng_(rng),
-                                                                                                                   sent_is_winning_(false) {}
+    explicit EndgameSolver(uint32_t tt_bits = ENDGAME_TT_BITS) : tt_(1ULL << tt_bits, 0) {}
 
-    MCTSAgent(const MCTSAgent &rhs) = delete;
+    // Looks positions up in tablebase (nullptr for none) before searching them.
+    void set_tablebase(const Tablebase *tablebase) { tablebase_ = tablebase; }
 
-    MCTSAgent(MCTSAgent &&rhs) = delete;
+    /**
+     * Solves position for the player to move, visiting at most max_nodes nodes and stopping once deadline
+     * (nullptr for none) expires.
+     * @return a winning line and true, or some legal line and false when every move loses; nullopt when the
+     * budget ran out.
+     */
+    optional<pair<uint32_t, bool>> solve(const Position &position, uint64_t max_nodes, const Deadline *deadline = nullptr) {
+        nodes_ = 0;
+        max_nodes_ = max_nodes;
+        deadline_ = deadline;
+        aborted_ = false;
+        uint64_t closing;
+        const uint64_t legal = position.legal_moves(&closing);
+        assert(legal != 0);
+        for (uint64_t moves : {legal & closing, legal & ~closing}) {
+            for (; moves; moves &= moves - 1) {
+                Position child = position;
+                child.apply_move(__builtin_ctzll(moves));
+                const bool child_wins = wins(child);
+                if (aborted_) return nullopt;
+                if (!child_wins) return make_pair(static_cast<uint32_t>(__builtin_ctzll(moves)), true);
+            }
+        }
+        return make_pair(static_cast<uint32_t>(__builtin_ctzll(legal)), false);
+    }
 
-    MCTSAgent &operator=(const MCTSAgent &rhs) = delete;
+    [[nodiscard]] uint64_t get_nodes() const noexcept { return nodes_; }
+};
 
-    MCTSAgent &operator=(MCTSAgent &&rhs) = delete;
+// --------- RegionSolver ---------------//
+/**
+ * Zuniq is impartial and the last player to move wins, so independent parts of a position add up as in
+ * Sprague-Grundy theory: the player to move wins iff the XOR of the parts' grundy values is not zero.
+ * Open regions only interact through the closed sizes, so regions whose still closable sizes overlap are
+ * grouped, and groups are independent.
+ *
+ * Whenever a position splits, every group but the largest is replaced by its grundy value (a nim heap) and
+ * the search goes on in the largest group plus that heap. This keeps the cutoffs of a win/loss search in the
+ * big group while small groups are solved once, memoised by their live lines and the closed sizes they can
+ * still reach, which is all a group's play depends on.
+ */
+class RegionSolver {
+    struct Group {
+        uint64_t lines;
+        // Sizes 1..(number of squares), and those of them that are not closed yet.
+        uint32_t range;
+        uint32_t sizes;
+    };
+
+    struct MemoKey {
+        uint64_t lines;
+        uint32_t closed_sizes;
+        uint32_t heap;
+
+        bool operator==(const MemoKey &rhs) const {
+            return lines == rhs.lines && closed_sizes == rhs.closed_sizes && heap == rhs.heap;
+        }
+    };
 
-    pair<Move, bool> select_move(const Board &game_state, const Context &ctx) override {
-        assert(color_ == game_state.get_turn());
-        Timer timer = Timer().start();
-        auto sgs = make_shared<Board>(game_state);
-        MCTSNode root = MCTSNode(sgs, nullptr, make_optional<Move>(), rng_);
-        for (uint32_t i = 0; i < num_rounds_; i++) {
-            if ((i % 10 == 0) && (timer.elapsed_milli() >= ts_->max_move_time(ctx))) {
-#ifndef QUIET_MODE                
-                cerr << "[I]: num_rounds: " << i << "/" << num_rounds_ << endl;
-#endif                
-                break;
+    struct MemoKeyHash {
+        size_t operator()(const MemoKey &k) const {
+            uint64_t z = (k.lines ^ ((k.closed_sizes | static_cast<uint64_t>(k.heap) << 32) * 0x9e3779b97f4a7c15ULL)) *
+                         0xbf58476d1ce4e5b9ULL;
+            return z ^ (z >> 31);
+        }
+    };
+
+    // A key and its value plus one, so that an empty entry never matches.
+    struct MemoEntry {
+        MemoKey key;
+        uint8_t stored;
+    };
+
+    // Grundy values of groups, and win/loss of a group plus a nim heap; a new entry replaces the one in its slot.
+    vector<MemoEntry> grundy_memo_;
+    vector<MemoEntry> wins_memo_;
+    uint32_t memo_shift_;
+    uint64_t nodes_ = 0;
+    uint64_t max_nodes_ = 0;
+    const Deadline *deadline_ = nullptr;
+    bool aborted_ = false;
+
+    static MemoKey key(const Position &position, const Group &group, uint32_t heap) {
+        return {group.lines & position.live_lines(), position.get_closed_sizes() & group.range, heap};
+    }
+
+    // Indexed by the high bits of the hash: its low bits only depend on the low bits of the key.
+    MemoEntry &slot(vector<MemoEntry> &memo, const MemoKey &k) const {
+        return memo[MemoKeyHash()(k) >> memo_shift_];
+    }
+
+    optional<uint8_t> recall(vector<MemoEntry> &memo, const MemoKey &k) const {
+        const MemoEntry &entry = slot(memo, k);
+        if (entry.stored == 0 || !(entry.key == k)) return nullopt;
+        return entry.stored - 1;
+    }
+
+    void remember(vector<MemoEntry> &memo, const MemoKey &k, uint8_t value) const {
+        slot(memo, k) = {k, static_cast<uint8_t>(value + 1)};
+    }
+
+    bool out_of_budget() {
+        if (++nodes_ > max_nodes_ || (deadline_ != nullptr && deadline_->expired())) aborted_ = true;
+        return aborted_;
+    }
+
+    /**
+     * Splits the live lines among `lines` into groups that can be played independently.
+     */
+    static vector<Group> decompose(const Position &position, uint64_t lines) {
+        const Position::Adjacency adj(position.get_drawn());
+        lines &= position.live_lines();
+        uint32_t squares = 0;
+        for (uint64_t todo = lines; todo; todo &= todo - 1) {
+            const uint32_t line = __builtin_ctzll(todo);
+            if (LINE_TABLES.side_a[line] >= 0) squares |= 1U << LINE_TABLES.side_a[line];
+            if (LINE_TABLES.side_b[line] >= 0) squares |= 1U << LINE_TABLES.side_b[line];
+        }
+        vector<Group> groups;
+        while (squares) {
+            const uint32_t region = adj.flood(squares & -squares);
+            squares &= ~region;
+            uint64_t region_lines = 0;
+            for (uint32_t todo = region; todo; todo &= todo - 1) {
+                region_lines |= LINE_TABLES.square_lines[__builtin_ctz(todo)];
             }
-            MCTSNode *node = &root;
-            while (!node->can_add_child() && !node->is_terminal()) {
-                node = this->select_child(node);
+            const uint32_t range = (2U << __builtin_popcount(region)) - 2;
+            Group group = {region_lines & lines, range, range & ~position.get_closed_sizes()};
+            // Merge every group that could close a size this one can close too.
+            for (size_t i = 0; i < groups.size();) {
+                if (groups[i].sizes & group.sizes) {
+                    group.lines |= groups[i].lines;
+                    group.range |= groups[i].range;
+                    group.sizes |= groups[i].sizes;
+                    groups[i] = groups.back();
+                    groups.pop_back();
+                    i = 0;
+                } else {
+                    i++;
+                }
             }
+            groups.push_back(group);
+        }
+        return groups;
+    }
 
-            // Add a new child node into the tree.
-            if (node->can_add_child()) {
-                node = &node->add_random_child();
-            }
+    /**
+     * Folds every group but the largest into heap and returns the largest one.
+     */
+    Group fold(const Position &position, const Group &group, uint32_t &heap) {
+        auto groups = decompose(position, group.lines);
+        if (groups.empty()) return {0, 0, 0};
+        auto largest = max_element(ALL(groups), [](const Group &a, const Group &b) {
+            return __builtin_popcountll(a.lines) < __builtin_popcountll(b.lines);
+        });
+        for (auto it = groups.begin(); it != groups.end() && !aborted_; ++it) {
+            if (it != largest) heap ^= grundy(position, *it);
+        }
+        return *largest;
+    }
 
-            // Simulate a random game from this node.
-            Player winner = this->simulate_random_game(*node->game_state_, ctx);
+    uint8_t grundy(const Position &position, const Group &group) {
+        if (out_of_budget()) return 0;
+        const MemoKey k = key(position, group, 0);
+        if (const auto known = recall(grundy_memo_, k)) return *known;
+
+        uint64_t seen = 0;
+        for (uint64_t moves = position.legal_moves(nullptr, group.lines); moves; moves &= moves - 1) {
+            Position child = position;
+            child.apply_move(__builtin_ctzll(moves));
+            uint32_t value = 0;
+            for (const auto &sub_group : decompose(child, group.lines)) {
+                value ^= grundy(child, sub_group);
+            }
+            if (aborted_) return 0;
+            seen |= 1ULL << value;
+        }
+        const auto value = static_cast<uint8_t>(__builtin_ctzll(~seen));
+        remember(grundy_memo_, k, value);
+        return value;
+    }
 
-            // Propagate scores back up the tree.
-            while (node != nullptr) {
-                node->record_win(winner);
-                node = node->parent_;
+    // True if the player to move wins the game made of group (in position) plus a nim heap.
+    bool wins(const Position &position, Group group, uint32_t heap) {
+        if (out_of_budget()) return false;
+        group = fold(position, group, heap);
+        if (aborted_) return false;
+        uint64_t closing;
+        const uint64_t legal = group.lines ? position.legal_moves(&closing, group.lines) : 0;
+        if (!legal) return heap != 0;
+
+        const MemoKey k = key(position, group, heap);
+        if (const auto known = recall(wins_memo_, k)) return *known != 0;
+
+        bool win = false;
+        for (uint64_t moves : {legal & closing, legal & ~closing}) {
+            for (; moves && !win; moves &= moves - 1) {
+                Position child = position;
+                child.apply_move(__builtin_ctzll(moves));
+                win = !wins(child, group, heap);
+                if (aborted_) return false;
             }
         }
+        for (uint32_t smaller = 0; smaller < heap && !win; smaller++) {
+            win = !wins(position, group, smaller);
+            if (aborted_) return false;
+        }
+        remember(wins_memo_, k, win);
+        return win;
+    }
 
+public:
+    explicit RegionSolver(uint32_t memo_bits = REGION_SOLVER_MEMO_BITS) : grundy_memo_(1ULL << memo_bits, MemoEntry{}),
+                                                                          wins_memo_(1ULL << memo_bits, MemoEntry{}),
+                                                                          memo_shift_(64 - memo_bits) {}
 
-#ifndef QUIET_MODE
-        auto scored_moves = root.top_n(TOP_N_FIRST_LEVEL);
+    /**
+     * Solves position for the player to move, visiting at most max_nodes nodes and stopping once deadline
+     * (nullptr for none) expires.
+     * @return a winning line and true, or some legal line and false when every move loses; nullopt when the
+     * budget ran out.
+     */
+    optional<pair<uint32_t, bool>> solve(const Position &position, uint64_t max_nodes, const Deadline *deadline = nullptr) {
+        nodes_ = 0;
+        max_nodes_ = max_nodes;
+        deadline_ = deadline;
+        aborted_ = false;
+        const Group all = {ALL_LINES, ALL_SQUARES << 1, (ALL_SQUARES << 1) & ~position.get_closed_sizes()};
+        uint64_t closing;
+        const uint64_t legal = position.legal_moves(&closing);
+        assert(legal != 0);
+        for (uint64_t moves : {legal & closing, legal & ~closing}) {
+            for (; moves; moves &= moves - 1) {
+                Position child = position;
+                child.apply_move(__builtin_ctzll(moves));
+                const bool child_wins = wins(child, all, 0);
+                if (aborted_) return nullopt;
+                if (!child_wins) return make_pair(static_cast<uint32_t>(__builtin_ctzll(moves)), true);
+            }
+        }
+        return make_pair(static_cast<uint32_t>(__builtin_ctzll(legal)), false);
+    }
 
-        cerr << "[I]: Top " << SZ(scored_moves) << " moves:\n";
+    [[nodiscard]] uint64_t get_nodes() const noexcept { return nodes_; }
+};
 
-        for (auto &score : scored_moves) {
-            cerr << "[I]: " << score << "\n";
+// --------- ProofNumberSolver ---------------//
+/**
+ * Depth-first proof-number search (df-pn) in negamax form. Each position has a proof number phi (how hard it
+ * is to prove that the player to move wins) and a disproof number delta; the search always goes down to a
+ * most-proving child and only comes back when the thresholds of its parent are passed. Both numbers live in a
+ * transposition table, so that coming back to a position is cheap.
+ * Zuniq positions transpose a lot, which makes summed disproof numbers count the same leaves many times over,
+ * so delta is the weak proof number instead: the largest child number plus one for each other open child.
+ * New positions start with delta at their number of legal moves, and the 1 + 1/4 trick keeps the search from
+ * switching back and forth between two children.
+ * It visits about half the nodes of EndgameSolver, at a higher cost per node, and it goes after forced wins in
+ * positions too large for an exhaustive search.
+ */
+class ProofNumberSolver {
+    static constexpr uint32_t INF = 1U << 30;
+
+    struct Entry {
+        uint64_t drawn;
+        uint32_t phi;
+        uint32_t delta;
+    };
+
+    vector<Entry> tt_;
+    const Tablebase *tablebase_ = nullptr;
+    uint64_t nodes_ = 0;
+    uint64_t max_nodes_ = 0;
+    const Deadline *deadline_ = nullptr;
+    bool aborted_ = false;
+
+    // Numbers of a position: from the table, or 1 and init_delta when it was never searched.
+    [[nodiscard]] pair<uint32_t, uint32_t> lookup(const Position &position, uint32_t init_delta = 1) const {
+        const Entry &entry = tt_[position.hash() & (tt_.size() - 1)];
+        // No stored position has both numbers 0, so an empty entry never matches.
+        if (entry.drawn == position.get_drawn() && (entry.phi | entry.delta) != 0) return {entry.phi, entry.delta};
+        return {1, init_delta};
+    }
 
-            auto sl_scored_moves = score.node_->top_n(TOP_N_SECOND_LEVEL);
+    void store(const Position &position, uint32_t phi, uint32_t delta) {
+        tt_[position.hash() & (tt_.size() - 1)] = {position.get_drawn(), phi, delta};
+    }
 
-            cerr << "[I]:\t\t";
-            for (auto &score2 : sl_scored_moves) {
-                cerr << score2 << ",";
+    // Searches position until its proof number reaches th_phi or its disproof number reaches th_delta.
+    void mid(const Position &position, uint32_t th_phi, uint32_t th_delta) {
+        if (++nodes_ > max_nodes_ || (deadline_ != nullptr && deadline_->expired())) {
+            aborted_ = true;
+            return;
+        }
+        uint64_t closing;
+        const uint64_t legal = position.legal_moves(&closing);
+        if (!legal) {
+            store(position, INF, 0);
+            return;
+        }
+        if (tablebase_ != nullptr) {
+            if (const optional<bool> win = tablebase_->probe(position, __builtin_popcountll(legal))) {
+                store(position, *win ? 0 : INF, *win ? INF : 0);
+                return;
             }
-            cerr << "\n";
         }
+        array<Position, TOTAL_MOVES> children;
+        array<uint32_t, TOTAL_MOVES> mobility;
+        size_t num_children = 0;
+        for (uint64_t moves : {legal & closing, legal & ~closing}) {
+            for (; moves; moves &= moves - 1) {
+                children[num_children] = position;
+                children[num_children].apply_move(__builtin_ctzll(moves));
+                mobility[num_children] = max(1, __builtin_popcountll(children[num_children].legal_moves()));
+                num_children++;
+            }
+        }
+        while (true) {
+            // The player to move wins through any child lost for the opponent, and loses only if all are won.
+            uint32_t phi = INF, delta = 0, second = INF, best_phi = 0, open = 0;
+            size_t best = 0;
+            for (size_t i = 0; i < num_children; i++) {
+                const auto [child_phi, child_delta] = lookup(children[i], mobility[i]);
+                delta = max(delta, child_phi);
+                open += child_phi != 0;
+                if (child_delta < phi) {
+                    second = phi;
+                    phi = child_delta;
+                    best = i;
+                    best_phi = child_phi;
+                } else if (child_delta < second) {
+                    second = child_delta;
+                }
+            }
+            if (delta < INF && open > 0) delta = min(INF - 1, delta + open - 1);
+            if (phi >= th_phi || delta >= th_delta || aborted_) {
+                store(position, phi, delta);
+                return;
+            }
+            mid(children[best], min(INF, th_delta - delta + best_phi), min(th_phi, second + second / 4 + 1));
+        }
+    }
 
-        cerr.flush();
+public:
+    explicit ProofNumberSolver(uint32_t tt_bits = PN_TT_BITS) : tt_(1ULL << tt_bits, Entry{0, 0, 0}) {}
+
+    // Looks positions up in tablebase (nullptr for none) before searching them.
+    void set_tablebase(const Tablebase *tablebase) { tablebase_ = tablebase; }
+
+    /**
+     * Solves position for the player to move, visiting at most max_nodes nodes and stopping once deadline
+     * (nullptr for none) expires.
+     * @return a winning line and true, or some legal line and false when every move loses; nullopt when the
+     * budget ran out.
+     */
+    optional<pair<uint32_t, bool>> solve(const Position &position, uint64_t max_nodes, const Deadline *deadline = nullptr) {
+        nodes_ = 0;
+        max_nodes_ = max_nodes;
+        deadline_ = deadline;
+        aborted_ = false;
+        const uint64_t legal = position.legal_moves();
+        assert(legal != 0);
+        mid(position, INF, INF);
+        if (aborted_) return nullopt;
+        if (lookup(position).first != 0) return make_pair(static_cast<uint32_t>(__builtin_ctzll(legal)), false);
+        // A child lost for the opponent; it is searched again if the table lost it.
+        for (uint64_t moves = legal; moves; moves &= moves - 1) {
+            Position child = position;
+            child.apply_move(__builtin_ctzll(moves));
+            if (lookup(child).second == 0) return make_pair(static_cast<uint32_t>(__builtin_ctzll(moves)), true);
+        }
+        for (uint64_t moves = legal; moves; moves &= moves - 1) {
+            Position child = position;
+            child.apply_move(__builtin_ctzll(moves));
+            mid(child, INF, INF);
+            if (aborted_) return nullopt;
+            if (lookup(child).second == 0) return make_pair(static_cast<uint32_t>(__builtin_ctzll(moves)), true);
+        }
+        return nullopt;
+    }
+
+    [[nodiscard]] uint64_t get_nodes() const noexcept { return nodes_; }
+};
+
+// --------- EndgameSolverAgent ---------------//
+/**
+ * Plays perfectly when the position can be solved within a node budget: first with the region solver, then
+ * with the plain one. Larger late middlegame positions get a proof-number search for a forced win. When none
+ * of them can, or when every move loses, the fallback agent moves instead: its choice gives the opponent more
+ * chances to go wrong. Every proven win is reported as a claim; game_loop sends only the first one of the game.
+ * The solvers share ENDGAME_SOLVER_TIME_SHARE of the move's time, and the time they use is charged to the fallback
+ * through CTX_VAR::MOVE_ELAPSED_MILLIS. A deterministic agent ignores the clock and relies on the node budgets
+ * alone, so that its moves do not depend on the machine's speed.
+ */
+class EndgameSolverAgent : public Agent {
+    Agent &fallback_;
+    unique_ptr<TimeStrategy> ts_;
+    uint64_t max_nodes_;
+    bool deterministic_;
+    EndgameSolver solver_;
+    RegionSolver region_solver_;
+    ProofNumberSolver pn_solver_;
+
+public:
+    EndgameSolverAgent(Player color, Agent &fallback, unique_ptr<TimeStrategy> &ts, bool deterministic = false,
+                       uint64_t max_nodes = ENDGAME_SOLVER_MAX_NODES) : Agent(color),
+                                                                        fallback_(fallback),
+                                                                        ts_(std::move(ts)),
+                                                                        max_nodes_(max_nodes),
+                                                                        deterministic_(deterministic) {}
+
+    void set_tablebase(const Tablebase *tablebase) {
+        solver_.set_tablebase(tablebase);
+        pn_solver_.set_tablebase(tablebase);
+    }
+
+    pair<Move, bool> select_move(const Board &game_state, const Context &ctx) override {
+        assert(color_ == game_state.get_turn());
+        Timer move_timer = Timer().start();
+        const Position position = game_state.position();
+        const auto available = static_cast<uint32_t>(__builtin_popcountll(position.legal_moves()));
+        optional<Deadline> timed;
+        if (!deterministic_) timed.emplace(ENDGAME_SOLVER_TIME_SHARE * ts_->max_move_time(ctx));
+        const Deadline *deadline = timed.has_value() ? &*timed : nullptr;
+        optional<pair<uint32_t, bool>> result;
+        if (available <= REGION_SOLVER_MAX_MOVES) {
+#ifndef QUIET_MODE
+            Timer timer = Timer().start();
+#endif
+            result = region_solver_.solve(position, REGION_SOLVER_MAX_NODES, deadline);
+#ifndef QUIET_MODE
+            timer.stop();
+            cerr << "[I]: Region solver " << (!result.has_value() ? "gave up" : (result->second ? "won" : "lost"))
+                 << " after " << region_solver_.get_nodes() << " nodes in " << timer.elapsed_milli() << " ms." << endl;
+#endif
+        }
+        if (!result.has_value() && available <= ENDGAME_SOLVER_MAX_MOVES) {
+#ifndef QUIET_MODE
+            Timer timer = Timer().start();
+#endif
+            result = solver_.solve(position, max_nodes_, deadline);
+#ifndef QUIET_MODE
+            timer.stop();
+            cerr << "[I]: Endgame solver " << (!result.has_value() ? "gave up" : (result->second ? "won" : "lost"))
+                 << " after " << solver_.get_nodes() << " nodes in " << timer.elapsed_milli() << " ms." << endl;
+#endif
+        }
+        if (!result.has_value() && available <= PN_SEARCH_MAX_MOVES) {
+#ifndef QUIET_MODE
+            Timer timer = Timer().start();
 #endif
+            result = pn_solver_.solve(position, PN_SEARCH_MAX_NODES, deadline);
+#ifndef QUIET_MODE
+            timer.stop();
+            cerr << "[I]: Proof-number search " << (!result.has_value() ? "gave up" : (result->second ? "won" : "lost"))
+                 << " after " << pn_solver_.get_nodes() << " nodes in " << timer.elapsed_milli() << " ms." << endl;
+#endif
+        }
+        if (result.has_value() && result->second) return make_pair(line_move(result->first), true);
+        // The fallback gets what is left of the move's time.
+        Context fallback_ctx = ctx;
+        fallback_ctx[CTX_VAR::MOVE_ELAPSED_MILLIS] += static_cast<int32_t>(move_timer.elapsed_milli());
+        return fallback_.select_move(game_state, fallback_ctx);
+    }
+};
 
-        const Move *best_move = nullptr;
-        double best_pct = -1.0;
-        for (auto &child : root.children_) {
-            double child_pct = child.winning_frac(game_state.get_turn());
-            if (child_pct > best_pct) {
-                best_pct = child_pct;
-                assert(child.move_.has_value());
-                best_move = &child.move_.value();
+// --------- OpeningBook -------------------//
+/**
+ * Moves for early positions, searched offline by book_builder.cpp. The file is an array of entries sorted by key,
+ * the smallest image of the drawn lines under the board's symmetries, so that one entry answers for every image of
+ * a position. It is memory-mapped and probed with a binary search; a missing or malformed file is an empty book.
+ */
+class OpeningBook {
+public:
+    struct Entry {
+        uint64_t key;
+        // Move in the frame of the key.
+        uint32_t line;
+        // Rounds searched to choose it.
+        uint32_t rounds;
+    };
+
+    static_assert(sizeof(Entry) == 16);
+
+    OpeningBook() = default;
+
+    explicit OpeningBook(const string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st {};
+        if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size % sizeof(Entry) == 0) {
+            void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                entries_ = static_cast<const Entry *>(data);
+                size_ = st.st_size / sizeof(Entry);
             }
         }
-        assert(best_move != nullptr);
-        bool is_winning = (best_pct > IS_WINNING_THRESHOLD) && (!sent_is_winning_) && (ctx.at(CTX_VAR::ROUND) >= MIN_ROUND_TO_CLAIM_IS_WINNING);
-        sent_is_winning_ = (sent_is_winning_ || is_winning);
+        close(fd);
+    }
+
+    OpeningBook(const OpeningBook &rhs) = delete;
+
+    OpeningBook &operator=(const OpeningBook &rhs) = delete;
+
+    ~OpeningBook() {
+        if (entries_ != nullptr) munmap(const_cast<Entry *>(entries_), size_ * sizeof(Entry));
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return size_; }
+
+    // Book line for the position, if it is in the book and still legal there.
+    [[nodiscard]] optional<uint32_t> probe(const Position &position) const {
+        const auto [key, symmetry] = canonical_lines(position.get_drawn());
+        const Entry *end = entries_ + size_;
+        const Entry *it = lower_bound(entries_, end, key, [](const Entry &e, uint64_t k) { return e.key < k; });
+        if (it == end || it->key != key || it->line >= TOTAL_MOVES) return nullopt;
+        const uint32_t line = SYMMETRY_TABLES.line_map[SYMMETRY_TABLES.inverse[symmetry]][it->line];
+        if (!((position.legal_moves() >> line) & 1ULL)) return nullopt;
+        return line;
+    }
+
+    // Saves entries as a book file, sorted by key.
+    static bool write(const string &path, vector<Entry> entries) {
+        sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.key < b.key; });
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char *>(entries.data()), static_cast<streamsize>(entries.size() * sizeof(Entry)));
+        return static_cast<bool>(out);
+    }
+
+private:
+    const Entry *entries_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Plays book moves, and lets the fallback agent move once out of book.
+class OpeningBookAgent : public Agent {
+    const OpeningBook &book_;
+    Agent &fallback_;
+
+public:
+    OpeningBookAgent(Player color, const OpeningBook &book, Agent &fallback) : Agent(color), book_(book),
+                                                                               fallback_(fallback) {}
 
+    pair<Move, bool> select_move(const Board &game_state, const Context &ctx) override {
+        assert(color_ == game_state.get_turn());
+        if (const optional<uint32_t> line = book_.probe(game_state.position())) {
 #ifndef QUIET_MODE
-        timer.stop();
-        cerr << "[I]: Selected: " << IO::format_move(*best_move) << (is_winning ? "!" : "") << " in "
-             << timer.elapsed_milli() << " ms." << endl;
+            cerr << "[I]: Book move " << IO::format_move(line_move(*line)) << endl;
 #endif
-        return make_pair(*best_move, is_winning);
+            return make_pair(line_move(*line), false);
+        }
+        return fallback_.select_move(game_state, ctx);
     }
+};
+
+// --------- NRPAAgent -------------------//
+/**
+ * Nested Rollout Policy Adaptation (Rosin, 2011), for offline analysis: no tree, only a RolloutPolicy per level.
+ * A level 0 search is a rollout with the policy; a level n search runs `iterations` searches of level n - 1,
+ * each from a copy of its policy, and after each one adapts its policy toward the best sequences so far.
+ * With two players and only a winner, each player's best sequence is the last one they won, and only their own
+ * moves in it adapt only their own weights (as in Playout Policy Adaptation), so neither learns to help the
+ * other. Policy keys are the player to move and the line.
+ *
+ * The top level runs once per thread, each with its own policy, and the move played is the root move the
+ * root player's policies give the most probability on average. It never claims a win: its win rates are
+ * between policies that keep adapting.
+ */
+class NRPAAgent : public Agent {
+public:
+    // One move of a rollout: the legal lines, and the line drawn. Players alternate from the one to move at the root.
+    struct Step {
+        uint64_t legal;
+        uint32_t line;
+    };
+    using Sequence = vector<Step>;
 
-private:
     /**
-     * Select a child according to the UCT metric.
-     * @param node : MCTSNode pointing to parent
-     * @return pointer to best MCTSNode child of this parent.
+     * @param num_threads : number of top level searches, each on its own thread.
+     * @param seed : when given, search is deterministic: every thread uses a stream derived from seed and the position.
      */
-    MCTSNode *select_child(MCTSNode *const node) const noexcept {
-        uint32_t total_rollouts = node->num_rollouts_;
-        double log_rollouts = log(total_rollouts);
+    explicit NRPAAgent(Player color, uint32_t level = NRPA_LEVEL, uint32_t iterations = NRPA_ITERATIONS,
+                       uint32_t num_threads = 1, optional<uint64_t> seed = nullopt) : Agent(color), level_(level),
+                                                                                      iterations_(iterations),
+                                                                                      num_threads_(max(1U, num_threads)),
+                                                                                      seed_(seed) {}
 
-        double best_score = -1.0;
-
-        MCTSNode *best_child = nullptr;
+    pair<Move, bool> select_move(const Board &game_state, const Context &) override {
+        assert(color_ == game_state.get_turn());
+#ifndef QUIET_MODE
+        Timer timer = Timer().start();
+#endif
+        const Position root = game_state.position();
+        const uint64_t position_seed = seed_.has_value() ? seed_.value() ^ game_state.hash() : 0;
+        vector<RolloutPolicy> policies(num_threads_);
+        vector<array<Sequence, 2>> best(num_threads_);
+        auto worker = [&](size_t t) {
+            if (seed_.has_value()) RNG::thread_rng() = RNG::stream(position_seed, t);
+            best[t] = search(root, level_, policies[t]);
+        };
+        vector<thread> helpers;
+        for (size_t t = 1; t < num_threads_; t++) {
+            helpers.emplace_back(worker, t);
+        }
+        worker(0);
+        for (auto &helper : helpers) {
+            helper.join();
+        }
 
-        for (int i = 0; i < SZ(node->children_); i++) {
-            MCTSNode &child = node->children_[i];
-            double win_percentage = child.winning_frac(node->game_state_->get_turn());
-            double exploration_factor = sqrt(log_rollouts / child.num_rollouts_);
-            double uct_score = win_percentage + temperature_ * exploration_factor;
-            if (uct_score > best_score) {
-                best_score = uct_score;
-                best_child = &node->children_[i];
+        policy_ = RolloutPolicy();
+        for (const auto &policy : policies) {
+            for (size_t p = 0; p < 2; p++) {
+                for (size_t line = 0; line < TOTAL_MOVES; line++) policy_.weights[p][line] += policy.weights[p][line] / num_threads_;
             }
         }
+        principal_line_.clear();
+        for (const Step &step : best[0][static_cast<int>(color_)]) principal_line_.push_back(step.line);
+
+        const uint64_t legal = root.legal_moves();
+        uint32_t best_line = __builtin_ctzll(legal);
+        double best_probability = -1.0;
+        for (uint64_t lines = legal; lines; lines &= lines - 1) {
+            const uint32_t line = __builtin_ctzll(lines);
+            double probability = 0.0;
+            for (const auto &policy : policies) probability += policy.probability(color_, legal, line);
+            if (probability > best_probability) {
+                best_probability = probability;
+                best_line = line;
+            }
+        }
+#ifndef QUIET_MODE
+        cerr << "[I]: NRPA selected: " << IO::format_move(line_move(best_line)) << " with probability "
+             << best_probability / num_threads_ << " in " << timer.elapsed_milli() << " ms." << endl;
+#endif
+        return make_pair(line_move(best_line), false);
+    }
 
-        assert(best_child != nullptr);
-        return best_child;
+    // Policy of the last search, averaged over threads; it can drive a RandomAgent (see RandomAgent::set_policy).
+    [[nodiscard]] const RolloutPolicy &policy() const noexcept { return policy_; }
+
+    // Last sequence of lines the player to move won in the first thread's last search (empty if none).
+    [[nodiscard]] const vector<uint32_t> &principal_line() const noexcept { return principal_line_; }
+
+private:
+    uint32_t level_;
+    uint32_t iterations_;
+    uint32_t num_threads_;
+    optional<uint64_t> seed_;
+    RolloutPolicy policy_;
+    vector<uint32_t> principal_line_;
+
+    // Best sequences of a search of this level from root: [p] is the last one player p won, empty if none.
+    array<Sequence, 2> search(const Position &root, uint32_t level, RolloutPolicy &policy) const {
+        if (level == 0) return rollout(root, policy);
+        array<Sequence, 2> best;
+        for (uint32_t i = 0; i < iterations_; i++) {
+            RolloutPolicy nested = policy;
+            array<Sequence, 2> result = search(root, level - 1, nested);
+            for (size_t p = 0; p < 2; p++) {
+                if (!result[p].empty()) best[p] = std::move(result[p]);
+            }
+            adapt(policy, best, root.get_turn());
+        }
+        return best;
     }
 
-    [[nodiscard]] Player simulate_random_game(Board game, const Context &ctx) const noexcept {
-        RandomAgent white_bot(Player::WHITE, rng_, WHITE_USE_WEIGHT_ROLLOUT, false);
-        RandomAgent black_bot(Player::BLACK, rng_, BLACK_USE_WEIGHT_ROLLOUT, false);
-        RandomAgent *bot;
-        while (!game.is_over()) {
-            if (game.get_turn() == Player::WHITE) bot = &white_bot;
-            else
-                bot = &black_bot;
-            auto [bot_move, _] = bot->select_move(game, ctx);
-            std::ignore = _;// pleases compiler warning.
-            game.apply_move(bot_move);
+    static array<Sequence, 2> rollout(Position position, const RolloutPolicy &policy) {
+        Xoshiro256 &rng = RNG::thread_rng();
+        const bool cached = use_legality_cache(position.get_drawn());
+        Sequence sequence;
+        uint64_t closing;
+        for (uint64_t legal = rollout_legal_moves(position, &closing, cached); legal; legal = rollout_legal_moves(position, &closing, cached)) {
+            const uint32_t line = policy.sample(position.get_turn(), legal, rng);
+            sequence.push_back({legal, line});
+            position.apply_move(line);
         }
-        return game.winner();
+        // The player left without a move loses.
+        array<Sequence, 2> result;
+        result[position.get_turn() == Player::WHITE ? 1 : 0] = std::move(sequence);
+        return result;
     }
 
-};// End of class MCTSAgent
+    // Gradient step of each player's softmax weights toward their own moves in the last sequence they won.
+    static void adapt(RolloutPolicy &policy, const array<Sequence, 2> &best, Player root_player) {
+        const RolloutPolicy old = policy;
+        for (size_t p = 0; p < 2; p++) {
+            auto &weights = policy.weights[p];
+            const auto &old_weights = old.weights[p];
+            for (size_t k = static_cast<size_t>(root_player) == p ? 0 : 1; k < best[p].size(); k += 2) {
+                const auto &[legal, line] = best[p][k];
+                double total = 0.0;
+                for (uint64_t lines = legal; lines; lines &= lines - 1) total += exp(old_weights[__builtin_ctzll(lines)]);
+                for (uint64_t lines = legal; lines; lines &= lines - 1) {
+                    const uint32_t l = __builtin_ctzll(lines);
+                    weights[l] -= NRPA_ALPHA * exp(old_weights[l]) / total;
+                }
+                weights[line] += NRPA_ALPHA;
+            }
+        }
+    }
+};
 
 void game_loop() {
     random_device dev;
-    mt19937 rng(dev());
+    if (DETERMINISTIC_SEARCH) RNG::seed(DETERMINISTIC_SEED);
+    else
+        RNG::seed((static_cast<uint64_t>(dev()) << 32) | dev());
 
-    unique_ptr<TimeStrategy> ts = make_unique<RemainingTimeStrategy>(TOTAL_TIME_MILLIS);
+    unique_ptr<TimeStrategy> ts;
+    if (USE_ADAPTIVE_TIME) ts = make_unique<AdaptiveTimeStrategy>(TOTAL_TIME_MILLIS);
+    else
+        ts = make_unique<RemainingTimeStrategy>(TOTAL_TIME_MILLIS);
 
-    unique_ptr<Agent> rnd_engine = make_unique<RandomAgent>(Player::BLACK, rng, false, true);
+    unique_ptr<Agent> rnd_engine = make_unique<RandomAgent>(Player::BLACK, false, true);
+
+    const OpeningBook book(OPENING_BOOK_FILE);
+#ifndef QUIET_MODE
+    cerr << "[I]: Opening book has " << book.size() << " positions." << endl;
+#endif
+    unique_ptr<Agent> book_engine = make_unique<OpeningBookAgent>(Player::BLACK, book, *rnd_engine);
 
-    unique_ptr<Agent> mcts_engine = make_unique<MCTSAgent>(NUM_ROUNDS, TEMPERATURE, ts, Player::BLACK, rng);
+    const Tablebase tablebase(TABLEBASE_FILE);
+#ifndef QUIET_MODE
+    cerr << "[I]: Tablebase has " << tablebase.size() << " positions." << endl;
+#endif
+    auto mcts_agent = make_unique<MCTSAgent>(NUM_ROUNDS, TEMPERATURE, ts, Player::BLACK, NUM_SEARCH_THREADS,
+                                             DETERMINISTIC_SEARCH ? make_optional(DETERMINISTIC_SEED) : nullopt);
+    if (tablebase.size() > 0) mcts_agent->set_tablebase(&tablebase);
+    unique_ptr<Agent> mcts_engine = std::move(mcts_agent);
+
+    unique_ptr<TimeStrategy> endgame_ts;
+    if (USE_ADAPTIVE_TIME) endgame_ts = make_unique<AdaptiveTimeStrategy>(TOTAL_TIME_MILLIS);
+    else
+        endgame_ts = make_unique<RemainingTimeStrategy>(TOTAL_TIME_MILLIS);
+    auto endgame_agent = make_unique<EndgameSolverAgent>(Player::BLACK, *mcts_engine, endgame_ts, DETERMINISTIC_SEARCH);
+    if (tablebase.size() > 0) endgame_agent->set_tablebase(&tablebase);
+    unique_ptr<Agent> endgame_engine = std::move(endgame_agent);
 
     Board board;
 
     Context ctx;
     int32_t &round_number = ctx[CTX_VAR::ROUND];
     int32_t &elapsed_time = ctx[CTX_VAR::ELAPSED_TIME_MILLIS];
+    int32_t &available_moves = ctx[CTX_VAR::AVAILABLE_MOVES];
 
     Timer timer;
     Timer opponent_timer;
 
     bool finished = false;
+    // The engines claim wins independently; only the first claim of the game is sent.
+    bool sent_is_winning = false;
     round_number = 0;
+    available_moves = TOTAL_MOVES;
     elapsed_time = 0;
 
     while (not finished) {
         string input = IO::readln();
         timer.start();
+        mcts_engine->stop_pondering();
         auto parsed = IO::parse_input(input);
         if (holds_alternative<GameCommand>(parsed)) {
 
@@ -1015,8 +3805,10 @@ void game_loop() {
 
                 case GameCommand::START: {
                     rnd_engine->set_color(Player::WHITE);
+                    book_engine->set_color(Player::WHITE);
                     mcts_engine->set_color(Player::WHITE);
-                    const auto &[move, _] = rnd_engine->select_move(board, ctx);
+                    endgame_engine->set_color(Player::WHITE);
+                    const auto &[move, _] = book_engine->select_move(board, ctx);
                     std::ignore = _;
                     if (!board.is_valid(move))
                         throw std::runtime_error("Move " + IO::format_move(move) + " is invalid!");
@@ -1041,17 +3833,25 @@ void game_loop() {
 #endif            
             elapsed_time += timer.elapsed_milli();
             timer.start();
+            available_moves = static_cast<int32_t>(board.get_available_moves().size());
             if (round_number < NUM_RANDOM_MOVE_ROUNDS)
-                tie(move, is_winning) = rnd_engine->select_move(board, ctx);
+                tie(move, is_winning) = book_engine->select_move(board, ctx);
+            else if (board.get_available_moves().size() <= max({ENDGAME_SOLVER_MAX_MOVES, REGION_SOLVER_MAX_MOVES, PN_SEARCH_MAX_MOVES}))
+                tie(move, is_winning) = endgame_engine->select_move(board, ctx);
             else
                 tie(move, is_winning) = mcts_engine->select_move(board, ctx);
             if (!board.is_valid(move)) throw std::runtime_error("Move " + IO::format_move(move) + " is invalid!");
             board.apply_move(move);
+            is_winning = is_winning && !sent_is_winning;
+            sent_is_winning = sent_is_winning || is_winning;
             string ws = is_winning ? "!" : "";
             IO::writeln(IO::format_move(move) + ws);
             opponent_timer.start();
             ++round_number;
             elapsed_time += timer.elapsed_milli();
+            if (USE_PONDERING && round_number + 1 >= NUM_RANDOM_MOVE_ROUNDS) {
+                mcts_engine->start_pondering(board, ctx);
+            }
         } else {
             throw std::runtime_error("Unrecognized input: " + input);
         }